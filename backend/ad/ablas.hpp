@@ -0,0 +1,92 @@
+/* Copyright 2023, 2024 Philipp Andelfinger, Justin Kreikemeyer
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the “Software”), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE. */
+
+/** Differentiable BLAS level 1 and 2 kernels over contiguous arrays of
+ * adoubles and doubles. In contrast to scalar loops such as
+ * "sum += w[k] * x[k]", no temporary is created per multiply-add: the values
+ * and tangents of each term are accumulated into the result directly, the two
+ * tangents of a product in a single pass. Operands with a sparse tangent (e.g.,
+ * program inputs used as weights) contribute a single component and the
+ * result stays sparse as long as all terms share one tangent dimension.
+ *
+ * Operands are either adouble or double. As in BLAS, the output must not alias
+ * the inputs.
+ */
+
+#pragma once
+
+#include <type_traits>
+
+namespace ablas {
+
+inline double val_of(double x) { return x; }
+inline double val_of(const adouble &x) { return x.val; }
+
+/** r += x[k] * y[k] for k in [0, n). */
+template <typename X, typename Y> void dot_acc(adouble &r, const X *x, const Y *y, int n) {
+  double v = r.val;
+  for (int k = 0; k < n; k++) {
+    double xv = val_of(x[k]), yv = val_of(y[k]);
+    v += xv * yv;
+    if constexpr (std::is_same_v<X, adouble> && std::is_same_v<Y, adouble>)
+      r.add_tang(x[k], yv, y[k], xv);
+    else if constexpr (std::is_same_v<X, adouble>)
+      r.add_tang(x[k], yv);
+    else if constexpr (std::is_same_v<Y, adouble>)
+      r.add_tang(y[k], xv);
+  }
+  r.val = v;
+}
+
+} // namespace ablas
+
+/** Dot product of x and y. */
+template <typename X, typename Y> adouble adot(const X *x, const Y *y, int n) {
+  adouble r = 0.0;
+  ablas::dot_acc(r, x, y, n);
+  return r;
+}
+
+/** y += a * x. */
+template <typename A, typename X> void aaxpy(int n, const A &a, const X *x, adouble *y) {
+  double av = ablas::val_of(a);
+  for (int k = 0; k < n; k++) {
+    double xv = ablas::val_of(x[k]);
+    y[k].val += av * xv;
+    if constexpr (std::is_same_v<A, adouble> && std::is_same_v<X, adouble>)
+      y[k].add_tang(x[k], av, a, xv);
+    else if constexpr (std::is_same_v<X, adouble>)
+      y[k].add_tang(x[k], av);
+    else if constexpr (std::is_same_v<A, adouble>)
+      y[k].add_tang(a, xv);
+  }
+}
+
+/** y = A x + beta y for the row-major m x n matrix A with row stride lda. */
+template <typename M, typename X>
+void agemv(int m, int n, const M *A, int lda, const X *x, double beta, adouble *y) {
+  for (int j = 0; j < m; j++) {
+    if (beta == 0.0)
+      y[j] = 0.0;
+    else if (beta != 1.0)
+      y[j] *= beta;
+    ablas::dot_acc(y[j], A + (size_t)j * lda, x, n);
+  }
+}
@@ -0,0 +1,235 @@
+/* Copyright 2023, 2024 Philipp Andelfinger, Justin Kreikemeyer
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the “Software”), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE. */
+
+/** Tangent-sparsity profiler for forward-mode AD, enabled by -DAD_PROFILE.
+ * Counts how often each operation hits the passive (no tangent), sparse (a
+ * single tangent component) and dense paths, and how often a dense tangent is
+ * created from operands without one ("promotions"). The counts are also kept
+ * per call site, identified by the return address of the counting function.
+ * The operations are forced inline so that, compiling with -g, the summary
+ * can resolve the sites to source lines in the model code via addr2line.
+ *
+ * Without AD_PROFILE, the macros expand to nothing.
+ */
+
+#pragma once
+
+#ifdef AD_PROFILE
+
+#include <algorithm>
+#include <cstdint>
+#include <dlfcn.h>
+#include <map>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ad_profile {
+
+enum path { passive, sparse, dense, num_paths };
+
+struct counts {
+  uint64_t paths[num_paths] = {};
+  uint64_t promotions = 0;
+
+  void operator+=(const counts &other) {
+    for (int p = 0; p < num_paths; p++)
+      paths[p] += other.paths[p];
+    promotions += other.promotions;
+  }
+};
+
+struct site_counts {
+  const char *op;
+  counts c;
+};
+
+/** Counters of one thread, merged for the summary. */
+struct thread_profile {
+  std::unordered_map<const char *, counts> ops;
+  std::unordered_map<void *, site_counts> sites;
+
+  static std::mutex &registry_mutex() {
+    static std::mutex m;
+    return m;
+  }
+
+  static std::vector<thread_profile *> &registry() {
+    static std::vector<thread_profile *> r;
+    return r;
+  }
+
+  static thread_profile &local() {
+    static thread_local thread_profile *p = [] {
+      auto *p = new thread_profile; // outlives the thread for the summary
+      std::lock_guard<std::mutex> lock(registry_mutex());
+      registry().push_back(p);
+      return p;
+    }();
+    return *p;
+  }
+};
+
+inline counts &site(const char *op, void *addr) {
+  auto &s = thread_profile::local().sites[addr];
+  s.op = op;
+  return s.c;
+}
+
+__attribute__((noinline)) inline void count(const char *op, path p) {
+  thread_profile::local().ops[op].paths[p]++;
+  site(op, __builtin_return_address(0)).paths[p]++;
+}
+
+__attribute__((noinline)) inline void promotion(const char *op) {
+  thread_profile::local().ops[op].promotions++;
+  site(op, __builtin_return_address(0)).promotions++;
+}
+
+/** Source locations of call sites: the innermost inlined frame outside the AD headers, or the address if unresolved. */
+inline std::unordered_map<void *, std::string> resolve(const std::vector<void *> &addrs) {
+  std::unordered_map<void *, std::string> locs;
+  std::map<std::string, std::vector<std::pair<void *, uintptr_t>>> by_module;
+  for (void *addr : addrs) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%p", addr);
+    locs[addr] = buf;
+
+    Dl_info info;
+    if (dladdr(addr, &info) && info.dli_fname != nullptr) // return addresses point past the call
+      by_module[info.dli_fname].push_back({addr, (uintptr_t)addr - 1 - (uintptr_t)info.dli_fbase});
+  }
+
+  for (auto &[module, offsets] : by_module) {
+    std::string cmd = "addr2line -a -i -e '" + module + "'";
+    for (auto &[addr, offset] : offsets) {
+      char buf[32];
+      snprintf(buf, sizeof(buf), " 0x%lx", (unsigned long)offset);
+      cmd += buf;
+    }
+    cmd += " 2>/dev/null";
+
+    FILE *f = popen(cmd.c_str(), "r");
+    if (f == nullptr)
+      continue;
+
+    // with -a, each group of frames is preceded by the queried address
+    char line[4096];
+    int group = -1;
+    bool found = false;
+    while (fgets(line, sizeof(line), f)) {
+      line[strcspn(line, "\n")] = '\0';
+      if (char *d = strstr(line, " (discriminator"))
+        *d = '\0';
+      if (strncmp(line, "0x", 2) == 0) {
+        group++;
+        found = false;
+        continue;
+      }
+      if (group < 0 || group >= (int)offsets.size() || found || strncmp(line, "??", 2) == 0)
+        continue;
+      void *addr = offsets[group].first;
+      if (strstr(line, "/ad/") == nullptr)
+        found = true;
+      if (found || locs[addr][0] == '0')
+        locs[addr] = line;
+    }
+    pclose(f);
+  }
+  return locs;
+}
+
+/** Print the counts per operation and the call sites with the most promotions and dense operations to stderr. */
+inline void print_summary(size_t max_sites = 20) {
+  fflush(stdout);
+  std::map<std::string, counts> ops;
+  std::unordered_map<void *, site_counts> sites;
+  {
+    std::lock_guard<std::mutex> lock(thread_profile::registry_mutex());
+    for (auto *p : thread_profile::registry()) {
+      for (auto &[op, c] : p->ops)
+        ops[op] += c;
+      for (auto &[addr, s] : p->sites) {
+        sites[addr].op = s.op;
+        sites[addr].c += s.c;
+      }
+    }
+  }
+
+  fprintf(stderr, "ad profile: operations\n");
+  fprintf(stderr, "%-24s %14s %14s %14s %14s\n", "op", "passive", "sparse", "dense", "promotions");
+  for (auto &[op, c] : ops)
+    fprintf(stderr, "%-24s %14lu %14lu %14lu %14lu\n", op.c_str(), c.paths[passive], c.paths[sparse], c.paths[dense], c.promotions);
+
+  // the counting calls of one operation are merged per source location
+  std::vector<void *> addrs;
+  for (auto &[addr, s] : sites)
+    addrs.push_back(addr);
+  auto locs = resolve(addrs);
+
+  std::map<std::pair<std::string, std::string>, counts> by_loc;
+  for (auto &[addr, s] : sites)
+    by_loc[{locs[addr], s.op}] += s.c;
+
+  std::vector<std::pair<std::pair<std::string, std::string>, counts>> sorted(by_loc.begin(), by_loc.end());
+  std::sort(sorted.begin(), sorted.end(), [](auto &a, auto &b) {
+    if (a.second.promotions != b.second.promotions)
+      return a.second.promotions > b.second.promotions;
+    return a.second.paths[dense] > b.second.paths[dense];
+  });
+  if (sorted.size() > max_sites)
+    sorted.resize(max_sites);
+
+  fprintf(stderr, "ad profile: call sites by promotions and dense operations\n");
+  fprintf(stderr, "%-24s %14s %14s %14s %14s  %s\n", "op", "passive", "sparse", "dense", "promotions", "site");
+  for (auto &[key, c] : sorted)
+    fprintf(stderr, "%-24s %14lu %14lu %14lu %14lu  %s\n", key.second.c_str(), c.paths[passive], c.paths[sparse], c.paths[dense],
+            c.promotions, key.first.c_str());
+}
+
+/** Clear the counters of all threads. */
+inline void reset() {
+  std::lock_guard<std::mutex> lock(thread_profile::registry_mutex());
+  for (auto *p : thread_profile::registry()) {
+    p->ops.clear();
+    p->sites.clear();
+  }
+}
+
+} // namespace ad_profile
+
+#define AD_PROFILE_INLINE __attribute__((always_inline)) inline
+#define AD_PROFILE_OP(OP, PATH) ad_profile::count(OP, ad_profile::PATH)
+#define AD_PROFILE_PROMOTION(OP, COND)                                         \
+  do {                                                                         \
+    if (COND)                                                                  \
+      ad_profile::promotion(OP);                                               \
+  } while (0)
+
+#else
+
+#define AD_PROFILE_INLINE inline
+#define AD_PROFILE_OP(OP, PATH)
+#define AD_PROFILE_PROMOTION(OP, COND)
+
+#endif
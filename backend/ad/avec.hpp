@@ -1,85 +1,352 @@
 #pragma once
 
+#include "ad_profile.hpp"
+#include "tang_kernels.hpp"
+
 #ifdef ENABLE_AD
 #define ENABLE_AD_DEFAULT true
 #else
 #define ENABLE_AD_DEFAULT false
 #endif
 
-template <int num_val_, int num_tang_> class avec {
+/** A fixed-length vector of differentiable values. Under forward-mode AD, the
+ *  tangents of the components are kept together with the same sparsity states
+ *  as fw_adouble. Under reverse-mode AD, the components are kept as individual
+ *  adoubles (avec<.., .., false>). */
+#ifdef RV_AD
+#define AVEC_DENSE_DEFAULT false
+#else
+#define AVEC_DENSE_DEFAULT true
+#endif
+
+/** Largest dense tangent block, in doubles, that is kept inside the vector
+ *  instead of the tangent pool. */
+#ifndef AVEC_INLINE_TANG_MAX
+#define AVEC_INLINE_TANG_MAX 32
+#endif
+
+template <int num_val_, int num_tang_, bool dense_ = AVEC_DENSE_DEFAULT>
+class avec;
+
+#ifndef RV_AD
+
+/** Like in fw_adouble, a vector without tangent is passive, a sparse vector
+ *  holds one tangent value per component for a single shared dimension, and a
+ *  dense vector holds a block with the tangent of each component stored
+ *  contiguously (structure of arrays), so that the loops over the tangents
+ *  vectorize without index arithmetic. Small blocks of a compile-time width are
+ *  kept inline, since allocating a block for each temporary would dominate. */
+template <int num_val_, int num_tang_> class avec<num_val_, num_tang_, true> {
 public:
   typedef avec<num_val_, num_tang_> own_t;
 
   double val[num_val_];
 #ifdef ENABLE_AD
-  double tang[num_val_ * num_tang_];
+  int tang_dim = -1;                // -1: none, INT_MAX: all
+  double sparse_tang_val[num_val_]; // tangent of each component for tang_dim if has_sparse_tang()
+  double *tang = nullptr;           // pooled dense block of num_val_ x width() unless use_inline
+
+  // a runtime width can only narrow a compile-time one
+  static constexpr bool use_inline = num_tang_ > 0 && num_val_ * num_tang_ <= AVEC_INLINE_TANG_MAX;
+  double inline_tang[use_inline ? num_val_ * num_tang_ : 1];
+
+  static int width() { return adouble::width(); }
+  static size_t block_size() { return (size_t)num_val_ * width(); }
+
+  bool has_tang() const { return tang_dim != -1; }
+  bool has_sparse_tang() const { return tang_dim != -1 && tang_dim != INT_MAX; }
+  bool has_full_tang() const { return tang_dim == INT_MAX; }
+
+  /** The dense block, valid if has_full_tang(). */
+  double *block() { return use_inline ? inline_tang : tang; }
+  const double *block() const { return use_inline ? inline_tang : tang; }
+
+  void alloc_tang() {
+    if (!use_inline && tang == nullptr)
+      tang = tang_pool::local().alloc(block_size());
+  }
+
+  void init_full_tang() {
+    if (has_full_tang())
+      return;
+
+    alloc_tang();
+    for (size_t i = 0, n = block_size(); i < n; i++)
+      block()[i] = 0.0;
+
+    if (has_sparse_tang())
+      for (int v = 0; v < num_val_; v++)
+        block()[v * width() + tang_dim] = sparse_tang_val[v];
+
+    tang_dim = INT_MAX;
+  }
 
   double &acc_tang(int val_idx, int tang_idx) {
-    return tang[val_idx * num_tang_ + tang_idx];
+    init_full_tang();
+    return block()[val_idx * width() + tang_idx];
   }
-  const double &get_tang(int val_idx, int tang_idx) const {
-    return tang[val_idx * num_tang_ + tang_idx];
+  double get_tang(int val_idx, int tang_idx) const {
+    if (has_full_tang())
+      return block()[val_idx * width() + tang_idx];
+    if (has_sparse_tang() && tang_idx == tang_dim)
+      return sparse_tang_val[val_idx];
+    return 0.0;
   }
   void set_tang(int val_idx, int tang_idx, double tang_val) {
-    get_tang(val_idx, tang_idx) = tang_val;
+    if (!has_tang()) {
+      tang_dim = tang_idx;
+      for (int v = 0; v < num_val_; v++)
+        sparse_tang_val[v] = 0.0;
+    }
+    if (tang_dim == tang_idx)
+      sparse_tang_val[val_idx] = tang_val;
+    else
+      acc_tang(val_idx, tang_idx) = tang_val;
+  }
+
+  /** Tangent state of the operands: the dimension as in tang_dim, and the
+   *  sparse and dense tangents of component v, where scalars are broadcast. */
+  static int dim_of(const own_t &x) { return x.tang_dim; }
+  static int dim_of(const adouble &x) { return x.tang_dim; }
+  static int dim_of(double x) { return -1; }
+
+  static double sparse_of(const own_t &x, int v) { return x.sparse_tang_val[v]; }
+  static double sparse_of(const adouble &x, int v) { return x.sparse_tang_val; }
+  static double sparse_of(double x, int v) { return 0.0; }
+
+  static const double *dense_of(const own_t &x, int v) { return x.block() + v * width(); }
+  static const double *dense_of(const adouble &x, int v) { return x.tang; }
+  static const double *dense_of(double x, int v) { return nullptr; }
+
+  /** Set the tangent of component v to da[v] * tangent(a, v) + db[v] * tangent(b, v).
+   *  a may alias this vector. */
+  template <typename A, typename B>
+  AD_PROFILE_INLINE void combine(const char *op, const A &a, const double *da, const B &b, const double *db) {
+    int a_dim = dim_of(a), b_dim = dim_of(b);
+    if (a_dim == -1 && b_dim == -1) {
+      AD_PROFILE_OP(op, passive);
+      tang_dim = -1;
+      return;
+    }
+
+    bool a_sparse = a_dim != INT_MAX, b_sparse = b_dim != INT_MAX;
+    if (a_sparse && b_sparse && (a_dim == b_dim || a_dim == -1 || b_dim == -1)) {
+      AD_PROFILE_OP(op, sparse);
+      for (int v = 0; v < num_val_; v++) {
+        double t = 0.0;
+        if (a_dim != -1)
+          t += da[v] * sparse_of(a, v);
+        if (b_dim != -1)
+          t += db[v] * sparse_of(b, v);
+        sparse_tang_val[v] = t;
+      }
+      tang_dim = a_dim != -1 ? a_dim : b_dim;
+      return;
+    }
+
+    AD_PROFILE_OP(op, dense);
+    AD_PROFILE_PROMOTION(op, a_sparse && b_sparse);
+    alloc_tang();
+    int n = width();
+    if (!a_sparse && !b_sparse) {
+      for (int v = 0; v < num_val_; v++) {
+        double *rt = block() + v * n;
+        tang_axpby(rt, da[v], dense_of(a, v), db[v], dense_of(b, v), n);
+      }
+    } else if (!a_sparse) {
+      for (int v = 0; v < num_val_; v++) {
+        double *rt = block() + v * n;
+        tang_scale(rt, da[v], dense_of(a, v), n);
+        if (b_dim != -1)
+          rt[b_dim] += db[v] * sparse_of(b, v);
+      }
+    } else if (!b_sparse) {
+      for (int v = 0; v < num_val_; v++) {
+        double *rt = block() + v * n;
+        tang_scale(rt, db[v], dense_of(b, v), n);
+        if (a_dim != -1)
+          rt[a_dim] += da[v] * sparse_of(a, v);
+      }
+    } else {
+      for (int v = 0; v < num_val_; v++) {
+        double *rt = block() + v * n;
+        for (int t = 0; t < n; t++)
+          rt[t] = 0.0;
+        rt[a_dim] += da[v] * sparse_of(a, v);
+        rt[b_dim] += db[v] * sparse_of(b, v);
+      }
+    }
+    tang_dim = INT_MAX;
+  }
+
+  /** The adouble with the given value and the tangent sum_v coeff[v] * tangent(v). */
+  adouble weighted_sum(const double *coeff, double value) const {
+    adouble r = value;
+    if (has_sparse_tang()) {
+      double t = 0.0;
+      for (int v = 0; v < num_val_; v++)
+        t += coeff[v] * sparse_tang_val[v];
+      r.tang_dim = tang_dim;
+      r.sparse_tang_val = t;
+    } else if (has_full_tang()) {
+      r.alloc_tang();
+      r.tang_dim = INT_MAX;
+      int n = width();
+      tang_scale(r.tang, coeff[0], block(), n);
+      for (int v = 1; v < num_val_; v++)
+        tang_add_scaled(r.tang, coeff[v], block() + v * n, n);
+    }
+    return r;
   }
 #endif
 
-  avec() {
-    for (int i = 0; i < num_val_; i++)
-      val[i] = 0.0;
+  static double comp_val(const own_t &x, int v) { return x.val[v]; }
+  static double comp_val(const adouble &x, int v) { return x.val; }
+  static double comp_val(double x, int v) { return x; }
 
+  /** Component-wise res = f(l, r), given the partial derivatives dl and dr wrt. l and r as functions of
+   *  the operand values. res may alias l. */
+  template <typename L, typename R, typename F, typename DL, typename DR>
+  AD_PROFILE_INLINE static void apply(own_t &res, const char *op, const L &l, const R &r, F f, DL dl, DR dr) {
+#ifdef ENABLE_AD
+    double da[num_val_], db[num_val_];
+#endif
+    for (int v = 0; v < num_val_; v++) {
+      double x = comp_val(l, v), y = comp_val(r, v);
+      res.val[v] = f(x, y);
+#ifdef ENABLE_AD
+      da[v] = dl(x, y);
+      db[v] = dr(x, y);
+#endif
+    }
 #ifdef ENABLE_AD
-    for (int i = 0; i < num_val_ * num_tang_; i++)
-      tang[i] = 0.0;
+    res.combine(op, l, da, r, db);
 #endif
   }
 
+  avec() {
+    for (int i = 0; i < num_val_; i++)
+      val[i] = 0.0;
+  }
+
   avec(const double x, const double y) {
     val[0] = x;
     val[1] = y;
-
-#ifdef ENABLE_AD
-    for (int i = 0; i < num_val_ * num_tang_; i++)
-      tang[i] = 0.0;
-#endif
   }
 
   avec(const adouble &x, const adouble &y) {
-    const adouble *xs[2] = {&x, &y};
-
-    for (int v = 0; v < num_val_; v++) {
-      val[v] = xs[v]->val;
-
-#ifdef ENABLE_AD
-      for (int t = 0; t < num_tang_; t++)
-        acc_tang(v, t) = xs[v]->get_tang(t);
-#endif
-    }
+    set(0, x);
+    set(1, y);
   }
 
   avec(const double x, const double y, const double z) {
     val[0] = x;
     val[1] = y;
-    val[2] = y;
+    val[2] = z;
+  }
 
+  avec(const adouble &x, const adouble &y, const adouble &z) {
+    set(0, x);
+    set(1, y);
+    set(2, z);
+  }
+
+  avec(const own_t &other) { *this = other; }
+
+  avec(own_t &&other) noexcept {
+#ifdef ENABLE_AD
+    if (use_inline) {
+      *this = other;
+      return;
+    }
+#endif
+    for (int v = 0; v < num_val_; v++)
+      val[v] = other.val[v];
 #ifdef ENABLE_AD
-    for (int i = 0; i < num_val_ * num_tang_; i++)
-      tang[i] = 0.0;
+    tang_dim = other.tang_dim;
+    if (other.has_sparse_tang())
+      for (int v = 0; v < num_val_; v++)
+        sparse_tang_val[v] = other.sparse_tang_val[v];
+    tang = other.tang;
+    other.tang = nullptr;
+    other.tang_dim = -1;
 #endif
   }
 
-  avec(const adouble &x, const adouble &y, const adouble &z) {
-    const adouble *xs[3] = {&x, &y, &z};
+  own_t &operator=(const own_t &other) {
+    for (int v = 0; v < num_val_; v++)
+      val[v] = other.val[v];
+#ifdef ENABLE_AD
+    if (other.has_full_tang()) {
+      alloc_tang();
+      for (size_t i = 0, n = block_size(); i < n; i++)
+        block()[i] = other.block()[i];
+    } else if (other.has_sparse_tang()) {
+      for (int v = 0; v < num_val_; v++)
+        sparse_tang_val[v] = other.sparse_tang_val[v];
+    }
+    tang_dim = other.tang_dim;
+#endif
+    return *this;
+  }
 
-    for (int v = 0; v < num_val_; v++) {
-      val[v] = xs[v]->val;
+  own_t &operator=(own_t &&other) noexcept {
+#ifdef ENABLE_AD
+    if (use_inline)
+      return *this = other;
+#endif
+    for (int v = 0; v < num_val_; v++)
+      val[v] = other.val[v];
+#ifdef ENABLE_AD
+    tang_dim = other.tang_dim;
+    if (other.has_sparse_tang())
+      for (int v = 0; v < num_val_; v++)
+        sparse_tang_val[v] = other.sparse_tang_val[v];
+    std::swap(tang, other.tang); // our old block is released with other
+    other.tang_dim = -1;
+#endif
+    return *this;
+  }
 
+  ~avec() {
 #ifdef ENABLE_AD
-      for (int t = 0; t < num_tang_; t++)
-        acc_tang(v, t) = xs[v]->get_tang(t);
+    if (!use_inline && tang != nullptr)
+      tang_pool::local().free(tang, block_size());
 #endif
+  }
+
+  /** Set component v to x. */
+  void set(int v, const adouble &x) {
+    val[v] = x.val;
+#ifdef ENABLE_AD
+    if (!x.has_tang() && !has_tang())
+      return;
+
+    if (!x.has_full_tang() && !has_full_tang() && (!has_tang() || !x.has_tang() || x.tang_dim == tang_dim)) {
+      AD_PROFILE_OP("avec", sparse);
+      if (!has_tang()) {
+        for (int w = 0; w < num_val_; w++)
+          sparse_tang_val[w] = 0.0;
+        tang_dim = x.tang_dim;
+      }
+      sparse_tang_val[v] = x.has_tang() ? x.sparse_tang_val : 0.0;
+      return;
+    }
+
+    AD_PROFILE_OP("avec", dense);
+    AD_PROFILE_PROMOTION("avec", !x.has_full_tang() && !has_full_tang());
+    init_full_tang();
+    double *rt = block() + v * width();
+    if (x.has_full_tang()) {
+      for (int t = 0, n = width(); t < n; t++)
+        rt[t] = x.tang[t];
+    } else {
+      for (int t = 0, n = width(); t < n; t++)
+        rt[t] = 0.0;
+      if (x.has_sparse_tang())
+        rt[x.tang_dim] = x.sparse_tang_val;
     }
+#endif
   }
 
   adouble squared_norm() const {
@@ -87,19 +354,15 @@ public:
     for (int i = 0; i < num_val_; i++)
       len += val[i] * val[i];
 
-    adouble r;
-    r.val = len;
-
 #ifdef ENABLE_AD
-    r.init_full_tang(false);
-    for (int t = 0; t < num_tang_; t++) {
-      double deriv = 0;
-      for (int v = 0; v < num_val_; v++)
-        deriv += 2 * val[v] * get_tang(v, t);
-      r.tang[t] = deriv;
-    }
+    AD_PROFILE_OP("avec squared_norm", dense);
+    double coeff[num_val_];
+    for (int v = 0; v < num_val_; v++)
+      coeff[v] = 2 * val[v];
+    return weighted_sum(coeff, len);
+#else
+    return len;
 #endif
-    return r;
   }
 
   adouble norm() const {
@@ -108,211 +371,263 @@ public:
       len += val[i] * val[i];
     len = sqrt(len);
 
-    adouble r;
-    r.val = len;
-
 #ifdef ENABLE_AD
-    r.init_full_tang(false);
-    for (int t = 0; t < num_tang_; t++) {
-      double deriv = 0;
-      for (int v = 0; v < num_val_; v++)
-        deriv += val[v] * get_tang(v, t);
-      deriv /= len;
-      r.tang[t] = deriv;
-    }
+    AD_PROFILE_OP("avec norm", dense);
+    double coeff[num_val_];
+    for (int v = 0; v < num_val_; v++)
+      coeff[v] = val[v] / len;
+    return weighted_sum(coeff, len);
+#else
+    return len;
 #endif
-    return r;
   }
 
   adouble dot(const own_t &other) const {
     own_t prod = *this * other;
 
-    adouble r = 0.0;
+    double r = 0.0;
     for (int v = 0; v < num_val_; v++)
-      r.val += prod.val[v];
+      r += prod.val[v];
 
 #ifdef ENABLE_AD
-    r.init_full_tang(false);
-    for (int t = 0; t < num_tang_; t++) {
-      double deriv = 0;
-      for (int v = 0; v < num_val_; v++)
-        deriv += prod.get_tang(v, t);
-      r.tang[t] = deriv;
-    }
-#endif
+    AD_PROFILE_OP("avec dot", dense);
+    double ones[num_val_];
+    for (int v = 0; v < num_val_; v++)
+      ones[v] = 1.0;
+    return prod.weighted_sum(ones, r);
+#else
     return r;
+#endif
+  }
 
-  };
+  /** Element-wise result of a unary function, given its values and derivatives. */
+  own_t chain(const double *r_val, const double *deriv) const {
+    own_t r;
+    for (int v = 0; v < num_val_; v++)
+      r.val[v] = r_val[v];
 
-  // expensive, not to be overused
-  adouble operator[](size_t v) const {
-    adouble r;
-    r.val = val[v];
 #ifdef ENABLE_AD
-    r.init_full_tang(false);
-    for (int t = 0; t < num_tang_; t++)
-      r.tang[t] = get_tang(v, t);
+    double zeros[num_val_] = {};
+    r.combine("avec chain", *this, deriv, 0.0, zeros);
 #endif
     return r;
   }
 
+  // expensive, not to be overused
+  adouble operator[](size_t v) const {
 #ifdef ENABLE_AD
+    if (has_full_tang()) {
+      adouble r = val[v];
+      r.set_full_tang(block() + v * width());
+      return r;
+    }
+    double coeff[num_val_] = {};
+    coeff[v] = 1.0;
+    return weighted_sum(coeff, val[v]);
+#else
+    return val[v];
+#endif
+  }
 
-#define BINARY_OP(OP, TANG_EXPR_V_V, TANG_EXPR_V_A, TANG_EXPR_V_D, SWAP_EXPR)  \
-  own_t operator OP(const own_t &other) const {                                \
+/* Each operator is provided for vectors, adoubles and doubles on either side.
+ * F is the component-wise operation on the values x and y, DL and DR are the
+ * partial derivatives wrt. x and y. */
+#define AVEC_BINARY_OP(OP, F, DL, DR)                                          \
+  AD_PROFILE_INLINE own_t operator OP(const own_t &other) const {              \
     own_t r;                                                                   \
-    for (int v = 0; v < num_val_; v++)                                         \
-      r.val[v] = val[v] OP other.val[v];                                       \
-                                                                               \
-    for (int i = 0; i < num_val_ * num_tang_; i++) {                           \
-      int v = i / num_tang_;                                                   \
-      (void)v;                                                                 \
-      r.tang[i] = TANG_EXPR_V_V;                                               \
-    }                                                                          \
-                                                                               \
+    apply(r, "avec operator" #OP, *this, other, F, DL, DR);                    \
     return r;                                                                  \
   }                                                                            \
                                                                                \
-  own_t operator OP(const adouble &other) const {                              \
+  AD_PROFILE_INLINE own_t operator OP(const adouble &other) const {            \
     own_t r;                                                                   \
-    for (int v = 0; v < num_val_; v++)                                         \
-      r.val[v] = val[v] OP other.val;                                          \
-                                                                               \
-    for (int i = 0; i < num_val_ * num_tang_; i++) {                           \
-      int v = i / num_tang_;                                                   \
-      (void)v;                                                                 \
-      int t = i % num_tang_;                                                   \
-      r.tang[i] = TANG_EXPR_V_A;                                               \
-    }                                                                          \
-                                                                               \
+    apply(r, "avec operator" #OP, *this, other, F, DL, DR);                    \
     return r;                                                                  \
   }                                                                            \
                                                                                \
-  friend own_t operator OP(const adouble &lhs, const own_t &rhs) {             \
-    return SWAP_EXPR;                                                          \
+  AD_PROFILE_INLINE own_t operator OP(const double &other) const {             \
+    own_t r;                                                                   \
+    apply(r, "avec operator" #OP, *this, other, F, DL, DR);                    \
+    return r;                                                                  \
   }                                                                            \
                                                                                \
-  own_t operator OP(const double &other) const {                               \
+  AD_PROFILE_INLINE friend own_t operator OP(const adouble &lhs,               \
+                                             const own_t &rhs) {               \
     own_t r;                                                                   \
-    for (int v = 0; v < num_val_; v++)                                         \
-      r.val[v] = val[v] OP other;                                              \
-                                                                               \
-    for (int i = 0; i < num_val_ * num_tang_; i++)                             \
-      r.tang[i] = TANG_EXPR_V_D;                                               \
-                                                                               \
+    apply(r, "avec operator" #OP, lhs, rhs, F, DL, DR);                        \
     return r;                                                                  \
   }                                                                            \
                                                                                \
-  friend own_t operator OP(const double &lhs, const own_t &rhs) {              \
-    return SWAP_EXPR;                                                          \
+  AD_PROFILE_INLINE friend own_t operator OP(const double &lhs,                \
+                                             const own_t &rhs) {               \
+    own_t r;                                                                   \
+    apply(r, "avec operator" #OP, lhs, rhs, F, DL, DR);                        \
+    return r;                                                                  \
   }                                                                            \
                                                                                \
-  void operator OP##=(const own_t &other) {                                    \
-    for (int i = 0; i < num_val_ * num_tang_; i++) {                           \
-      int v = i / num_tang_;                                                   \
-      (void)v;                                                                 \
-      tang[i] = TANG_EXPR_V_V;                                                 \
-    }                                                                          \
-                                                                               \
-    for (int v = 0; v < num_val_; v++)                                         \
-      val[v] OP## = other.val[v];                                              \
+  AD_PROFILE_INLINE void operator OP##=(const own_t &other) {                  \
+    apply(*this, "avec operator" #OP "=", *this, other, F, DL, DR);            \
   }                                                                            \
                                                                                \
-  void operator OP##=(const adouble &other) {                                  \
-    for (int i = 0; i < num_val_ * num_tang_; i++) {                           \
-      int v = i / num_tang_;                                                   \
-      (void)v;                                                                 \
-      int t = i % num_tang_;                                                   \
-      tang[i] = TANG_EXPR_V_A;                                                 \
-    }                                                                          \
-                                                                               \
-    for (int v = 0; v < num_val_; v++)                                         \
-      val[v] OP## = other.val;                                                 \
+  AD_PROFILE_INLINE void operator OP##=(const adouble &other) {                \
+    apply(*this, "avec operator" #OP "=", *this, other, F, DL, DR);            \
   }                                                                            \
                                                                                \
-  void operator OP##=(const double &other) {                                   \
-    for (int i = 0; i < num_val_ * num_tang_; i++)                             \
-      tang[i] = TANG_EXPR_V_D;                                                 \
-                                                                               \
-    for (int v = 0; v < num_val_; v++)                                         \
-      val[v] OP## = val[v] OP other;                                           \
+  AD_PROFILE_INLINE void operator OP##=(const double &other) {                 \
+    apply(*this, "avec operator" #OP "=", *this, other, F, DL, DR);            \
   }
 
-#else
+  AVEC_BINARY_OP(+, [](double x, double y) { return x + y; },
+                 [](double x, double y) { return 1.0; },
+                 [](double x, double y) { return 1.0; });
+  AVEC_BINARY_OP(-, [](double x, double y) { return x - y; },
+                 [](double x, double y) { return 1.0; },
+                 [](double x, double y) { return -1.0; });
+  AVEC_BINARY_OP(*, [](double x, double y) { return x * y; },
+                 [](double x, double y) { return y; },
+                 [](double x, double y) { return x; });
+  AVEC_BINARY_OP(/, [](double x, double y) { return x / y; },
+                 [](double x, double y) { return 1.0 / y; },
+                 [](double x, double y) { return -x / (y * y); });
+
+  own_t operator-() const {
+    own_t r;
+    apply(r, "avec operator-", *this, 0.0, [](double x, double y) { return -x; },
+          [](double x, double y) { return -1.0; }, [](double x, double y) { return 0.0; });
+    return r;
+  }
+};
+
+#endif // RV_AD
+
+/** Under reverse-mode AD, the components are recorded on the tape individually,
+ *  since converting between a dense vector tangent and the tape would cost a
+ *  reverse sweep per conversion. With a runtime tangent width, the components
+ *  share the adouble's pooled tangent storage. */
+template <int num_val_, int num_tang_> class avec<num_val_, num_tang_, false> {
+public:
+  typedef avec<num_val_, num_tang_> own_t;
+
+  double val[num_val_];
+  adouble comp[num_val_]; // tape nodes of the components, comp[v].val is not kept up to date
+
+  adouble at(int v) const {
+    adouble r = comp[v];
+    r.val = val[v];
+    return r;
+  }
 
-#define BINARY_OP(OP, TANG_EXPR_V_V, TANG_EXPR_V_A, TANG_EXPR_V_D, SWAP_EXPR)  \
+  void set(int v, const adouble &x) {
+    comp[v] = x;
+    val[v] = x.val;
+  }
+
+  double get_tang(int val_idx, int tang_idx) const { return at(val_idx).get_tang(tang_idx); }
+
+  avec() {
+    for (int i = 0; i < num_val_; i++)
+      val[i] = 0.0;
+  }
+
+  avec(const double x, const double y) {
+    val[0] = x;
+    val[1] = y;
+  }
+
+  avec(const adouble &x, const adouble &y) {
+    set(0, x);
+    set(1, y);
+  }
+
+  avec(const double x, const double y, const double z) {
+    val[0] = x;
+    val[1] = y;
+    val[2] = z;
+  }
+
+  avec(const adouble &x, const adouble &y, const adouble &z) {
+    set(0, x);
+    set(1, y);
+    set(2, z);
+  }
+
+  adouble squared_norm() const {
+    adouble r = 0.0;
+    for (int v = 0; v < num_val_; v++)
+      r += at(v) * at(v);
+    return r;
+  }
+
+  adouble norm() const { return sqrt(squared_norm()); }
+
+  adouble dot(const own_t &other) const {
+    adouble r = 0.0;
+    for (int v = 0; v < num_val_; v++)
+      r += at(v) * other.at(v);
+    return r;
+  }
+
+  adouble operator[](size_t v) const { return at(v); }
+
+  own_t chain(const double *r_val, const double *deriv) const {
+    own_t r;
+    for (int v = 0; v < num_val_; v++) {
+      adouble c;
+      c.set_unary(at(v), r_val[v], deriv[v]);
+      r.set(v, c);
+    }
+    return r;
+  }
+
+#define RV_AVEC_BINARY_OP(OP)                                                  \
   own_t operator OP(const own_t &other) const {                                \
     own_t r;                                                                   \
     for (int v = 0; v < num_val_; v++)                                         \
-      r.val[v] = val[v] OP other.val[v];                                       \
+      r.set(v, at(v) OP other.at(v));                                          \
     return r;                                                                  \
   }                                                                            \
                                                                                \
   own_t operator OP(const adouble &other) const {                              \
     own_t r;                                                                   \
     for (int v = 0; v < num_val_; v++)                                         \
-      r.val[v] = val[v] OP other.val;                                          \
+      r.set(v, at(v) OP other);                                                \
     return r;                                                                  \
   }                                                                            \
                                                                                \
   friend own_t operator OP(const adouble &lhs, const own_t &rhs) {             \
-    return SWAP_EXPR;                                                          \
+    own_t r;                                                                   \
+    for (int v = 0; v < num_val_; v++)                                         \
+      r.set(v, lhs OP rhs.at(v));                                              \
+    return r;                                                                  \
   }                                                                            \
                                                                                \
   own_t operator OP(const double &other) const {                               \
     own_t r;                                                                   \
     for (int v = 0; v < num_val_; v++)                                         \
-      r.val[v] = val[v] OP other;                                              \
+      r.set(v, at(v) OP other);                                                \
     return r;                                                                  \
   }                                                                            \
                                                                                \
   friend own_t operator OP(const double &lhs, const own_t &rhs) {              \
-    return SWAP_EXPR;                                                          \
-  }                                                                            \
-                                                                               \
-  void operator OP##=(const own_t &other) {                                    \
-    for (int v = 0; v < num_val_; v++)                                         \
-      val[v] OP## = other.val[v];                                              \
-  }                                                                            \
-                                                                               \
-  void operator OP##=(const adouble &other) {                                  \
+    own_t r;                                                                   \
     for (int v = 0; v < num_val_; v++)                                         \
-      val[v] OP## = other.val;                                                 \
+      r.set(v, lhs OP rhs.at(v));                                              \
+    return r;                                                                  \
   }                                                                            \
                                                                                \
-  void operator OP##=(const double &other) {                                   \
-    for (int v = 0; v < num_val_; v++)                                         \
-      val[v] OP## = val[v] OP other;                                           \
-  }
+  void operator OP##=(const own_t &other) { *this = *this OP other; }          \
+  void operator OP##=(const adouble &other) { *this = *this OP other; }        \
+  void operator OP##=(const double &other) { *this = *this OP other; }
 
-#endif
-
-#define OTHER_ADOUBLE_TANG other.get_tang(t)                                   
-
-  BINARY_OP(+, tang[i] + other.tang[i], tang[i] + OTHER_ADOUBLE_TANG, tang[i],
-            rhs + lhs);
-  BINARY_OP(-, tang[i] - other.tang[i], tang[i] - OTHER_ADOUBLE_TANG, tang[i],
-            -rhs + lhs);
-  BINARY_OP(*, val[v] * other.tang[i] + tang[i] * other.val[v],
-            val[v] * OTHER_ADOUBLE_TANG + tang[i] * other.val, tang[i] * other,
-            rhs *lhs);
-  BINARY_OP(/,
-            ((tang[i] * other.val[v] - val[v] * other.tang[i]) /
-             (other.val[v] * other.val[v])),
-            ((tang[i] * other.val - val[v] * OTHER_ADOUBLE_TANG) /
-             (other.val * other.val)),
-            tang[i] / other, {NAN}); // TODO: divide scalar by vector
+  RV_AVEC_BINARY_OP(+);
+  RV_AVEC_BINARY_OP(-);
+  RV_AVEC_BINARY_OP(*);
+  RV_AVEC_BINARY_OP(/);
 
   own_t operator-() const {
     own_t r;
     for (int v = 0; v < num_val_; v++)
-      r.val[v] = val[v];
-
-#ifdef ENABLE_AD
-    for (int i = 0; i < num_val_ * num_tang_; i++)
-      r.tang[i] = tang[i];
-#endif
-
+      r.set(v, -at(v));
     return r;
   }
 };
@@ -21,6 +21,11 @@
 /** Operator-overloading implementation of forward-mode AD with basic sparsity
  * optimizations. Requires only a single pass by carrying along the tangents for
  * all program inputs. Relies on the compiler for vectorization.
+ *
+ * Dense tangents are held in blocks from a per-thread pool (see tang_pool.hpp),
+ * so that moves only transfer the block and containers of adoubles can grow
+ * and swap without copying tangents. The loops over dense tangents are in
+ * tang_kernels.hpp.
  */
 
 #pragma once
@@ -35,8 +40,11 @@
 #include <type_traits>
 #include <unordered_set>
 #include <vector>
+#include "ad_profile.hpp"
+#include "tang_kernels.hpp"
+#include "tang_pool.hpp"
 
-extern uint64_t global_branch_id;
+extern thread_local uint64_t global_branch_id;
 extern bool in_branch;
 const uint64_t initial_global_branch_id = 11061421359639307453UL;
 
@@ -67,14 +75,19 @@ template <int num_tang_, bool enable_ad_ = ENABLE_AD_DEFAULT> class fw_adouble {
 public:
   static const int num_tangents = num_tang_; // for external access
 
+  /** Number of tangent components, fixed at compile time or, for num_tang_ < 0, at startup. */
+  static int width() { return tang_width<num_tang_>::get(); }
+  static void set_width(int n) { tang_width<num_tang_>::set(n); }
+
 #if DGO_FORK_LIMIT != 0
-  static uint64_t set_counter; // for global ordering
+  static thread_local uint64_t set_counter; // for global ordering
 
   pair<uint64_t, uint64_t> set_at = {initial_global_branch_id, 0};
 #endif
 
   double val;
-  double tang[num_tang_];
+  double *tang = nullptr; // dense tangent block from the pool, valid if has_full_tang()
+  double sparse_tang_val = 0.0; // tangent for tang_dim if has_sparse_tang()
 
   int tang_dim = -1; // -1: none, INT_MAX: all
 
@@ -113,29 +126,58 @@ public:
 
   void init_val(double x) { val = x; };
 
+  // forward mode keeps no tape, the tangents are carried along with the values
+  static void tape_reset() {}
+  static void tape_mark() {}
+  static void tape_rewind() {}
+  void freeze() {}
+  void release() { clear_tang(); }
+
+  /** Make sure a dense block is allocated, keeping it across state changes until destruction. */
+  void alloc_tang() {
+    if (tang == nullptr)
+      tang = tang_pool::local().alloc(width());
+  }
+
   void clone_tang(const adouble_t &other) {
     tang_dim = other.tang_dim;
     if (other.has_full_tang()) {
-      for (int t = 0; t < num_tang_; t++)
+      alloc_tang();
+      for (int t = 0, n = width(); t < n; t++)
         tang[t] = other.tang[t];
     } else {
-      tang[tang_dim] = other.tang[tang_dim];
+      sparse_tang_val = other.sparse_tang_val;
     }
   }
 
-  void become(const adouble_t &&other) {
-    *this = other;
+  /** Take over the value and tangent of other, leaving other with our previous block. */
+  void steal(adouble_t &other) {
+    val = other.val;
+    tang_dim = other.tang_dim;
+    sparse_tang_val = other.sparse_tang_val;
+    if (has_full_tang()) {
+      double *t = tang;
+      tang = other.tang;
+      other.tang = t;
+      other.tang_dim = -1;
+    }
+  }
+
+  void become(adouble_t &&other) {
+    steal(other);
     // XXX set_at not updated here because it's not needed for our use case
   }
 
   adouble_t &operator=(adouble_t &&other) {
-    *this = other;
+    if (this == &other)
+      return *this;
+    steal(other);
     mark_set(other);
     return *this;
   }
 
 #define ITER_TANG(TANG_EXPR)                                                   \
-  for (int i = 0; enable_ad_ && i < num_tang_; i++) {                          \
+  for (int i = 0, n = r.width(); enable_ad_ && i < n; i++) {                   \
     r.tang[i] = TANG_EXPR;                                                     \
   }
 
@@ -148,6 +190,16 @@ public:
 
   fw_adouble(const fw_adouble &other) { *this = other; }
 
+  fw_adouble(fw_adouble &&other) noexcept {
+    val = other.val;
+    tang_dim = other.tang_dim;
+    sparse_tang_val = other.sparse_tang_val;
+    tang = other.tang;
+    other.tang = nullptr;
+    other.tang_dim = -1;
+    mark_set(other);
+  }
+
   adouble_t &operator=(double other) {
     if (has_tang() || other != val)
       mark_set();
@@ -168,21 +220,18 @@ public:
   fw_adouble() : fw_adouble(0.0) {}
 
   ~fw_adouble() {
-    if (!enable_ad_)
-      return;
-    clear_tang();
+    if (tang != nullptr)
+      tang_pool::local().free(tang, width());
   }
 
   void init_full_tang(bool zero_out = false, bool force = false) {
     if (has_full_tang() || (!enable_ad_ && !force))
       return;
 
-    double sparse_tang_val;
-    if (has_sparse_tang())
-      sparse_tang_val = tang[tang_dim];
+    alloc_tang();
 
     if (zero_out)
-      for (int t = 0; t < num_tang_; t++)
+      for (int t = 0, n = width(); t < n; t++)
         tang[t] = 0.0;
 
     if (has_sparse_tang())
@@ -193,9 +242,20 @@ public:
 
   double get_val() const { return val; }
 
+  void set_full_tang(const double *t) {
+    if (!enable_ad_)
+      return;
+
+    init_full_tang(false);
+    for (int k = 0, n = width(); k < n; k++)
+      tang[k] = t[k];
+  }
+
   double get_tang(int k) const {
-    if (has_full_tang() || (has_sparse_tang() && k == tang_dim))
+    if (has_full_tang())
       return tang[k];
+    if (has_sparse_tang() && k == tang_dim)
+      return sparse_tang_val;
     return 0.0;
   }
 
@@ -203,17 +263,84 @@ public:
     if (!enable_ad_)
       return;
 
-    if (!has_tang()) {
+    if (!has_tang() || (has_sparse_tang() && k == tang_dim)) {
       tang_dim = k;
-      tang[k] = a;
+      sparse_tang_val = a;
       return;
     }
 
+    AD_PROFILE_PROMOTION("set_tang", !has_full_tang());
     init_full_tang(true);
 
     tang[k] = a;
   }
 
+  /** Make this the result of a unary function of x with value v and derivative d. */
+  AD_PROFILE_INLINE void set_unary(const adouble_t &x, double v, double d) {
+    val = v;
+    mark_set(x);
+    tang_dim = x.tang_dim;
+    if (!x.has_tang()) {
+      AD_PROFILE_OP("set_unary", passive);
+    } else if (x.has_sparse_tang()) {
+      AD_PROFILE_OP("set_unary", sparse);
+      sparse_tang_val = d * x.sparse_tang_val;
+    } else {
+      AD_PROFILE_OP("set_unary", dense);
+      alloc_tang();
+      tang_scale(tang, d, x.tang, width());
+    }
+  }
+
+  /** Add s times the tangent of x to our tangent, staying sparse if x is
+   *  passive or shares our tangent dimension. The value is left untouched. */
+  AD_PROFILE_INLINE void add_tang(const adouble_t &x, double s) {
+    mark_set(x);
+    if (!x.has_tang()) {
+      AD_PROFILE_OP("add_tang", passive);
+      return;
+    }
+
+    if (x.has_sparse_tang()) {
+      if (!has_tang()) {
+        AD_PROFILE_OP("add_tang", sparse);
+        tang_dim = x.tang_dim;
+        sparse_tang_val = s * x.sparse_tang_val;
+        return;
+      }
+      if (tang_dim == x.tang_dim) {
+        AD_PROFILE_OP("add_tang", sparse);
+        sparse_tang_val += s * x.sparse_tang_val;
+        return;
+      }
+      AD_PROFILE_OP("add_tang", dense);
+      AD_PROFILE_PROMOTION("add_tang", !has_full_tang());
+      init_full_tang(true);
+      tang[x.tang_dim] += s * x.sparse_tang_val;
+      return;
+    }
+
+    AD_PROFILE_OP("add_tang", dense);
+    init_full_tang(true);
+    tang_add_scaled(tang, s, x.tang, width());
+  }
+
+  /** Same as add_tang(x, sx) followed by add_tang(y, sy), in a single pass
+   *  over the tangents if both are dense. */
+  AD_PROFILE_INLINE void add_tang(const adouble_t &x, double sx, const adouble_t &y, double sy) {
+    if (!x.has_full_tang() || !y.has_full_tang()) {
+      add_tang(x, sx);
+      add_tang(y, sy);
+      return;
+    }
+
+    mark_set(x);
+    mark_set(y);
+    AD_PROFILE_OP("add_tang", dense);
+    init_full_tang(true);
+    tang_add_axpby(tang, sx, x.tang, sy, y.tang, width());
+  }
+
   bool has_tang() const { return tang_dim != -1; }
   bool has_sparse_tang() const {
     return tang_dim != -1 && tang_dim != INT_MAX;
@@ -226,52 +353,68 @@ public:
   double dummy_op(const adouble_t &a, const adouble_t &b) const { return a.val; };
 
 
-#define FW_ADOUBLE_BINARY_OP(IS_INFIX, OP_NAME, INFIX_OP, PREFIX_OP, TANG_EXPR_A_A, TANG_EXPR_A_D)        \
-  adouble_t OP_NAME(const adouble_t &other) const {                            \
+/* The tangents are combined from the partial derivatives D_OWN_A_A and
+   D_OTHER_A_A wrt. the operands if both are adoubles, or D_OWN_A_D if other is
+   a double. */
+#define FW_ADOUBLE_BINARY_OP(IS_INFIX, OP_NAME, INFIX_OP, PREFIX_OP, D_OWN_A_A, D_OTHER_A_A, D_OWN_A_D) \
+  AD_PROFILE_INLINE adouble_t OP_NAME(const adouble_t &other) const {          \
     fw_adouble r;                                                              \
     r.val = IS_INFIX ? val INFIX_OP other.val : PREFIX_OP(val, other.val);     \
     r.mark_set(other);                                                         \
-    if (!has_tang() && !other.has_tang())                                      \
+    if (!has_tang() && !other.has_tang()) {                                    \
+      AD_PROFILE_OP(#OP_NAME, passive);                                        \
       return r;                                                                \
+    }                                                                          \
     bool only_one_tang_dim = ((!has_tang() && other.has_sparse_tang()) ||      \
                               (!other.has_tang() && has_sparse_tang()));       \
     if (only_one_tang_dim ||                                                   \
         (has_sparse_tang() && other.tang_dim == tang_dim)) {                   \
       int i = has_sparse_tang() ? tang_dim : other.tang_dim;                   \
-      r.tang[i] = TANG_EXPR_A_A;                                               \
+      r.sparse_tang_val = TANG_EXPR_A_A(D_OWN_A_A, D_OTHER_A_A);               \
       r.tang_dim = i;                                                          \
+      AD_PROFILE_OP(#OP_NAME, sparse);                                         \
       return r;                                                                \
     }                                                                          \
+    AD_PROFILE_OP(#OP_NAME, dense);                                            \
+    AD_PROFILE_PROMOTION(#OP_NAME, !has_full_tang() && !other.has_full_tang());\
     r.init_full_tang(true);                                                    \
-    ITER_TANG(TANG_EXPR_A_A);                                                  \
+    if (enable_ad_ && has_full_tang() && other.has_full_tang())                \
+      tang_axpby(r.tang, D_OWN_A_A, tang, D_OTHER_A_A, other.tang, r.width()); \
+    else                                                                       \
+      ITER_TANG(TANG_EXPR_A_A(D_OWN_A_A, D_OTHER_A_A));                        \
     return r;                                                                  \
   }                                                                            \
-  adouble_t OP_NAME(double other) const {                                      \
+  AD_PROFILE_INLINE adouble_t OP_NAME(double other) const {                    \
     fw_adouble r;                                                              \
     r.val = IS_INFIX ? val INFIX_OP other : PREFIX_OP(val, other);             \
     r.mark_set(*this);                                                         \
                                                                                \
-    if (!has_tang())                                                           \
+    if (!has_tang()) {                                                         \
+      AD_PROFILE_OP(#OP_NAME, passive);                                        \
       return r;                                                                \
+    }                                                                          \
                                                                                \
     if (has_sparse_tang()) {                                                   \
-      int i = tang_dim;                                                        \
-      r.tang[i] = TANG_EXPR_A_D;                                               \
+      r.sparse_tang_val = (D_OWN_A_D) * sparse_tang_val;                       \
       r.tang_dim = tang_dim;                                                   \
+      AD_PROFILE_OP(#OP_NAME, sparse);                                         \
       return r;                                                                \
     }                                                                          \
-    r.init_full_tang(true);                                                    \
-    ITER_TANG(TANG_EXPR_A_D);                                                  \
+    AD_PROFILE_OP(#OP_NAME, dense);                                            \
+    r.init_full_tang();                                                        \
+    if (enable_ad_)                                                            \
+      tang_scale(r.tang, D_OWN_A_D, tang, r.width());                          \
     return r;                                                                  \
   }
 
-#define FW_ADOUBLE_ASSIGN_OP(ASSIGN_OP, BINARY_OP, TANG_EXPR_A_A,              \
-                             TANG_EXPR_A_D, ITER_TANG_EXPR_A_D)                \
-  void operator ASSIGN_OP(const adouble_t &other) {                            \
+#define FW_ADOUBLE_ASSIGN_OP(ASSIGN_OP, BINARY_OP, D_OWN_A_A, D_OTHER_A_A,     \
+                             D_OWN_A_D)                                        \
+  AD_PROFILE_INLINE void operator ASSIGN_OP(const adouble_t &other) {          \
     mark_set(other);                                                           \
     fw_adouble &r = *this;                                                     \
                                                                                \
     if (!has_tang() && !other.has_tang()) {                                    \
+      AD_PROFILE_OP("operator" #ASSIGN_OP, passive);                           \
       val ASSIGN_OP other.val;                                                 \
       return;                                                                  \
     }                                                                          \
@@ -280,30 +423,40 @@ public:
     if (only_one_tang_dim ||                                                   \
         (has_sparse_tang() && other.tang_dim == tang_dim)) {                   \
       int i = has_sparse_tang() ? tang_dim : other.tang_dim;                   \
-      r.tang[i] = TANG_EXPR_A_A;                                      \
+      r.sparse_tang_val = TANG_EXPR_A_A(D_OWN_A_A, D_OTHER_A_A);               \
       r.tang_dim = i;                                                          \
+      AD_PROFILE_OP("operator" #ASSIGN_OP, sparse);                            \
       val ASSIGN_OP other.val;                                                 \
       return;                                                                  \
     }                                                                          \
+    AD_PROFILE_OP("operator" #ASSIGN_OP, dense);                               \
+    AD_PROFILE_PROMOTION("operator" #ASSIGN_OP,                                \
+                         !has_full_tang() && !other.has_full_tang());          \
     init_full_tang(true);                                                      \
-    ITER_TANG(TANG_EXPR_A_A);                                                  \
+    if (enable_ad_ && other.has_full_tang())                                   \
+      tang_axpby(tang, D_OWN_A_A, tang, D_OTHER_A_A, other.tang, width());     \
+    else                                                                       \
+      ITER_TANG(TANG_EXPR_A_A(D_OWN_A_A, D_OTHER_A_A));                        \
     val ASSIGN_OP other.val;                                                   \
     return;                                                                    \
   }                                                                            \
-  void operator ASSIGN_OP(double other) {                                      \
+  AD_PROFILE_INLINE void operator ASSIGN_OP(double other) {                    \
     mark_set();                                                                \
     if (!has_tang()) {                                                         \
+      AD_PROFILE_OP("operator" #ASSIGN_OP, passive);                           \
       val ASSIGN_OP other;                                                     \
       return;                                                                  \
     }                                                                          \
-    fw_adouble &r = *this;                                                     \
+    double d = D_OWN_A_D;                                                      \
     if (has_sparse_tang()) {                                                   \
-      int i = tang_dim;                                                        \
-      r.tang[i] = TANG_EXPR_A_D;                                      \
-      r.tang_dim = tang_dim;                                                   \
+      sparse_tang_val *= d;                                                    \
+      AD_PROFILE_OP("operator" #ASSIGN_OP, sparse);                            \
+    }                                                                          \
+    if (has_full_tang()) {                                                     \
+      AD_PROFILE_OP("operator" #ASSIGN_OP, dense);                             \
+      if (d != 1.0)                                                            \
+        tang_scale(tang, d, tang, width());                                    \
     }                                                                          \
-    if (has_full_tang())                                                       \
-      ITER_TANG_EXPR_A_D;                                                      \
     val ASSIGN_OP other;                                                       \
     return;                                                                    \
   }
@@ -311,50 +464,49 @@ public:
 #define OWN_TANG get_tang(i)
 #define OTHER_TANG other.get_tang(i)
 
-#define ADD_TANG (OWN_TANG + OTHER_TANG)
-#define SUB_TANG (OWN_TANG - OTHER_TANG)
-#define MUL_TANG (val * OTHER_TANG + OWN_TANG * other.val)
-#define DIV_TANG                                                               \
-  ((OWN_TANG * other.val - val * OTHER_TANG) / (other.val * other.val))
-#define ATAN2_TANG                                                             \
-  ((-OTHER_TANG * val + OWN_TANG * other.val) /                                \
-   ((val * val) + (other.val * other.val)))
-
-  FW_ADOUBLE_BINARY_OP(true, operator+, +, dummy_op, ADD_TANG, OWN_TANG);
-  FW_ADOUBLE_BINARY_OP(true, operator-, -, dummy_op, SUB_TANG, OWN_TANG);
-  FW_ADOUBLE_BINARY_OP(true, operator*, *, dummy_op, MUL_TANG, OWN_TANG *other);
-  FW_ADOUBLE_BINARY_OP(true, operator/, /, dummy_op, DIV_TANG, OWN_TANG / other);
-
-  FW_ADOUBLE_BINARY_OP(false, atan2, +, std::atan2, ATAN2_TANG,
-                       (OWN_TANG * other) / ((val * val) + (other * other)));
-
-  FW_ADOUBLE_BINARY_OP(false, powc, +, std::pow, assert(false),
-                       OWN_TANG *(other *std::pow(val, other - 1)));
-
-  FW_ADOUBLE_ASSIGN_OP(+=, +, ADD_TANG, OWN_TANG, ); // nothing to do here
-  FW_ADOUBLE_ASSIGN_OP(-=, -, SUB_TANG, OWN_TANG, ); // nothing to do here
-  FW_ADOUBLE_ASSIGN_OP(*=, *, MUL_TANG, OWN_TANG *other,
-                       ITER_TANG(OWN_TANG *other));
-  FW_ADOUBLE_ASSIGN_OP(/=, /, DIV_TANG, OWN_TANG / other,
-                       ITER_TANG(OWN_TANG / other));
-
-  adouble_t operator-() const {
+#define TANG_EXPR_A_A(D_OWN, D_OTHER) ((D_OWN) * OWN_TANG + (D_OTHER) * OTHER_TANG)
+
+#define DIV_D_OTHER (-val / (other.val * other.val))
+#define ATAN2_DENOM ((val * val) + (other.val * other.val))
+
+  FW_ADOUBLE_BINARY_OP(true, operator+, +, dummy_op, 1.0, 1.0, 1.0);
+  FW_ADOUBLE_BINARY_OP(true, operator-, -, dummy_op, 1.0, -1.0, 1.0);
+  FW_ADOUBLE_BINARY_OP(true, operator*, *, dummy_op, other.val, val, other);
+  FW_ADOUBLE_BINARY_OP(true, operator/, /, dummy_op, 1.0 / other.val, DIV_D_OTHER, 1.0 / other);
+
+  FW_ADOUBLE_BINARY_OP(false, atan2, +, std::atan2, other.val / ATAN2_DENOM, -val / ATAN2_DENOM,
+                       other / ((val * val) + (other * other)));
+
+  FW_ADOUBLE_BINARY_OP(false, powc, +, std::pow, (assert(false), 0.0), 0.0,
+                       other * std::pow(val, other - 1));
+
+  FW_ADOUBLE_ASSIGN_OP(+=, +, 1.0, 1.0, 1.0);
+  FW_ADOUBLE_ASSIGN_OP(-=, -, 1.0, -1.0, 1.0);
+  FW_ADOUBLE_ASSIGN_OP(*=, *, other.val, val, other);
+  FW_ADOUBLE_ASSIGN_OP(/=, /, 1.0 / other.val, DIV_D_OTHER, 1.0 / other);
+
+  AD_PROFILE_INLINE adouble_t operator-() const {
     fw_adouble r;
     r.val = -val;
 
     r.mark_set(*this);
 
-    if (!has_tang())
+    if (!has_tang()) {
+      AD_PROFILE_OP("operator-", passive);
       return r;
+    }
 
     if (has_sparse_tang()) {
+      AD_PROFILE_OP("operator-", sparse);
       r.tang_dim = tang_dim;
-      r.tang[tang_dim] = -r.tang[tang_dim];
+      r.sparse_tang_val = -sparse_tang_val;
       return r;
     }
 
-    r.init_full_tang(true);
-    ITER_TANG(-OWN_TANG);
+    AD_PROFILE_OP("operator-", dense);
+    r.init_full_tang();
+    if (enable_ad_)
+      tang_scale(r.tang, -1.0, tang, r.width());
 
     return r;
   }
@@ -402,93 +554,104 @@ bool operator!=(double lhs, const adouble_t &rhs) {
 }
 
 #if DGO_FORK_LIMIT != 0
-template <int num_tang_, bool enable_ad_> uint64_t adouble_t::set_counter = 1;
+template <int num_tang_, bool enable_ad_> thread_local uint64_t adouble_t::set_counter = 1;
 #endif
 
 template <int num_tang_, bool enable_ad_>
-adouble_t operator+(double lhs, const adouble_t &rhs) {
+AD_PROFILE_INLINE adouble_t operator+(double lhs, const adouble_t &rhs) {
   return rhs + lhs;
 }
 template <int num_tang_, bool enable_ad_>
-adouble_t operator-(double lhs, const adouble_t &rhs) {
+AD_PROFILE_INLINE adouble_t operator-(double lhs, const adouble_t &rhs) {
   adouble_t r;
   r.val = lhs - rhs.val;
 
-  if (!rhs.has_tang())
+  if (!rhs.has_tang()) {
+    AD_PROFILE_OP("operator-", passive);
     return r;
+  }
 
   if (rhs.has_sparse_tang()) {
+    AD_PROFILE_OP("operator-", sparse);
     r.tang_dim = rhs.tang_dim;
-    r.tang[r.tang_dim] = -rhs.tang[rhs.tang_dim];
+    r.sparse_tang_val = -rhs.sparse_tang_val;
     return r;
   }
 
+  AD_PROFILE_OP("operator-", dense);
   r.init_full_tang();
-  ITER_TANG(-rhs.tang[i]);
+  if (enable_ad_)
+    tang_scale(r.tang, -1.0, rhs.tang, r.width());
   return r;
 }
 
 template <int num_tang_, bool enable_ad_>
-adouble_t operator*(double lhs, const adouble_t &rhs) {
+AD_PROFILE_INLINE adouble_t operator*(double lhs, const adouble_t &rhs) {
   return rhs * lhs;
 }
 template <int num_tang_, bool enable_ad_>
-adouble_t operator/(double lhs, const adouble_t &rhs) {
+AD_PROFILE_INLINE adouble_t operator/(double lhs, const adouble_t &rhs) {
   adouble_t r;
   r.val = lhs / rhs.val;
 
-  if (!rhs.has_tang())
+  if (!rhs.has_tang()) {
+    AD_PROFILE_OP("operator/", passive);
     return r;
+  }
 
   if (rhs.has_sparse_tang()) {
+    AD_PROFILE_OP("operator/", sparse);
     r.tang_dim = rhs.tang_dim;
-    r.tang[r.tang_dim] = -lhs * rhs.tang[rhs.tang_dim] / (rhs.val * rhs.val);
+    r.sparse_tang_val = -lhs * rhs.sparse_tang_val / (rhs.val * rhs.val);
     return r;
   }
 
+  AD_PROFILE_OP("operator/", dense);
   r.init_full_tang();
-  ITER_TANG(-lhs * rhs.tang[i] / (rhs.val * rhs.val));
+  if (enable_ad_)
+    tang_scale(r.tang, -lhs / (rhs.val * rhs.val), rhs.tang, r.width());
   return r;
 }
 
-#define FW_ADOUBLE_UNARY_OP(FUNC, TANG_EXPR)                                   \
+/* DERIV_EXPR is evaluated once per call, r.val holds the result. */
+#define FW_ADOUBLE_UNARY_OP(FUNC, DERIV_EXPR)                                  \
   template <int num_tang_, bool enable_ad_>                                    \
-  adouble_t FUNC(const adouble_t &x) {                                         \
+  AD_PROFILE_INLINE adouble_t FUNC(const adouble_t &x) {                       \
     adouble_t r;                                                               \
     r.val = FUNC(x.val);                                                       \
     r.mark_set(x);                                                             \
-    if (x.has_sparse_tang()) {                                                 \
-      int i = x.tang_dim;                                                      \
-      r.tang_dim = i;                                                          \
-      r.tang[i] = TANG_EXPR;                                                   \
+    if (!x.has_tang()) {                                                       \
+      AD_PROFILE_OP(#FUNC, passive);                                           \
       return r;                                                                \
     }                                                                          \
-    if (x.tang) {                                                              \
-      r.init_full_tang();                                                      \
-      ITER_TANG(TANG_EXPR);                                                    \
+    double d = DERIV_EXPR;                                                     \
+    if (x.has_sparse_tang()) {                                                 \
+      r.tang_dim = x.tang_dim;                                                 \
+      r.sparse_tang_val = d * x.sparse_tang_val;                               \
+      AD_PROFILE_OP(#FUNC, sparse);                                            \
+      return r;                                                                \
     }                                                                          \
+    AD_PROFILE_OP(#FUNC, dense);                                               \
+    r.init_full_tang();                                                        \
+    if (enable_ad_)                                                            \
+      tang_scale(r.tang, d, x.tang, r.width());                                \
     return r;                                                                  \
   }
 
-#define UNARY_OWN_TANG x.get_tang(i)
-
-FW_ADOUBLE_UNARY_OP(exp, r.val *UNARY_OWN_TANG); // r.val == exp(x.val)
-FW_ADOUBLE_UNARY_OP(sin, cos(x.val) * UNARY_OWN_TANG);
-FW_ADOUBLE_UNARY_OP(cos, -sin(x.val) * UNARY_OWN_TANG);
-FW_ADOUBLE_UNARY_OP(sqrt, (1.0 / (2.0 * r.val)) *
-                              UNARY_OWN_TANG); // r.val == sqrt(x.val)
-FW_ADOUBLE_UNARY_OP(log, (1.0 / x.val) * UNARY_OWN_TANG);
-FW_ADOUBLE_UNARY_OP(erf, (2.0 * exp(-(x.val * x.val)) / sqrt(M_PI)) *
-                             UNARY_OWN_TANG);
-FW_ADOUBLE_UNARY_OP(tanh, ipow(1 - r.val, 2) *
-                              UNARY_OWN_TANG); // r.val == tanh(x.val)
+FW_ADOUBLE_UNARY_OP(exp, r.val); // r.val == exp(x.val)
+FW_ADOUBLE_UNARY_OP(sin, cos(x.val));
+FW_ADOUBLE_UNARY_OP(cos, -sin(x.val));
+FW_ADOUBLE_UNARY_OP(sqrt, 1.0 / (2.0 * r.val)); // r.val == sqrt(x.val)
+FW_ADOUBLE_UNARY_OP(log, 1.0 / x.val);
+FW_ADOUBLE_UNARY_OP(erf, 2.0 * exp(-(x.val * x.val)) / sqrt(M_PI));
+FW_ADOUBLE_UNARY_OP(tanh, 1.0 - r.val * r.val); // r.val == tanh(x.val)
 
 template <int num_tang_, bool enable_ad_>
-adouble_t atan2(const adouble_t &a, const adouble_t &b) {
+AD_PROFILE_INLINE adouble_t atan2(const adouble_t &a, const adouble_t &b) {
   return a.atan2(b);
 }
 template <int num_tang_, bool enable_ad_>
-adouble_t powc(const adouble_t &a, const double b) {
+AD_PROFILE_INLINE adouble_t powc(const adouble_t &a, const double b) {
   return a.powc(b);
 }
 
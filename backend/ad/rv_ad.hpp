@@ -0,0 +1,676 @@
+/* Copyright 2023, 2024 Philipp Andelfinger, Justin Kreikemeyer
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the “Software”), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE. */
+
+/** Operator-overloading implementation of reverse-mode AD. Operations on
+ * active values append a node holding the local partial derivatives to a tape,
+ * and the tangents wrt. all program inputs are obtained by a reverse sweep from
+ * the value whose tangent is requested. The cost of one value's gradient is
+ * thus a constant multiple of the primal run, independent of num_inputs, but
+ * the cost grows with the number of values whose gradients are needed.
+ *
+ * The tape is an arena that keeps its capacity and is rewound for each sample.
+ * Values that have to outlive a rewind (e.g., DGO's tangent carriers) are
+ * frozen, which stores their dense tangent outside of the tape. The tangents of
+ * all values frozen since the last rewind are computed together by one sweep
+ * over the tape, carrying either an adjoint per frozen value (reverse) or the
+ * tangents wrt. all inputs (forward), whichever is fewer. Hence, the work per
+ * node is bounded by min(#frozen values, num_inputs).
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <assert.h>
+#include <cstdint>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+#include "tang_pool.hpp"
+
+#if DGO_FORK_LIMIT != 0
+#error "reverse-mode AD does not support DGO_FORK_LIMIT"
+#endif
+
+#ifdef AD_PROFILE
+#error "the AD profiler requires forward-mode AD"
+#endif
+
+extern thread_local uint64_t global_branch_id;
+extern bool in_branch;
+const uint64_t initial_global_branch_id = 11061421359639307453UL;
+
+static constexpr int int_ceil(double x) {
+  const int i = x;
+  return x > i ? i + 1 : i;
+}
+
+template <typename T> T ipow(T x, int p) {
+  if (p == 0)
+    return (T)1.0;
+
+  T r = x;
+  while (--p > 0)
+    r *= x;
+  return r;
+}
+
+#ifdef ENABLE_AD
+#define ENABLE_AD_DEFAULT true
+#else
+#define ENABLE_AD_DEFAULT false
+#endif
+
+/** Tape of a single thread. Nodes refer to their (up to two) arguments by index. */
+template <int num_tang_> class rv_tape {
+public:
+  struct node {
+    int32_t arg[2];
+    double partial[2];
+  };
+
+  /** Contribution of a leaf node to the tangent of input dimension dim. */
+  struct seed {
+    int32_t node;
+    int32_t dim;
+    double weight;
+  };
+
+  std::vector<node> nodes;
+  std::vector<seed> seeds;
+  std::vector<double> frozen; /**< dense tangents of frozen values, width() per value */
+  std::vector<int32_t> free_frozen; /**< released slots of frozen, reused before growing it */
+
+  /** A frozen value whose slot is yet to be filled with the tangents of its node. */
+  struct pending_freeze {
+    int32_t node;
+    int32_t slot;
+  };
+  std::vector<pending_freeze> pending;
+  std::vector<bool> slot_pending; /**< per slot of frozen, whether it awaits the next flush() */
+
+  static constexpr size_t max_flush_adjoints = 1 << 22; /**< bound on the adjoints held by one sweep of flush() */
+
+  uint32_t epoch = 1;      /**< incremented on each rewind to detect stale nodes */
+  uint32_t reset_epoch = 1; /**< epoch of the last reset, older nodes belong to a previous tape */
+  uint32_t mark_epoch = 1; /**< epoch in which the mark was set */
+  size_t mark_nodes = 0;   /**< nodes below the mark survive rewinds */
+  size_t mark_seeds = 0;
+
+  rv_tape() {
+    nodes.reserve(1 << 16);
+    seeds.reserve(1 << 10);
+  }
+
+  static int width() { return tang_width<num_tang_>::get(); }
+
+  int32_t push(int32_t a, double da, int32_t b = -1, double db = 0.0) {
+    nodes.push_back({{a, b}, {da, db}});
+    return nodes.size() - 1;
+  }
+
+  void push_seed(int32_t n, int dim, double weight) {
+    seeds.push_back({n, dim, weight});
+    invalidate();
+  }
+
+  /** Drop the cached sweep after seeds have been modified. */
+  void invalidate() { version++; }
+
+  /** Remember the current end of the tape, e.g., after seeding the program inputs. */
+  void mark() {
+    mark_nodes = nodes.size();
+    mark_seeds = seeds.size();
+    mark_epoch = epoch;
+  }
+
+  /** Discard everything recorded after the mark, keeping the arena's capacity. */
+  void rewind() {
+    flush();
+    nodes.resize(mark_nodes);
+    seeds.resize(mark_seeds);
+    epoch++;
+    invalidate();
+  }
+
+  /** Discard all nodes and frozen values. */
+  void reset() {
+    mark_nodes = mark_seeds = 0;
+    frozen.clear();
+    free_frozen.clear();
+    pending.clear();
+    slot_pending.clear();
+    rewind();
+    reset_epoch = mark_epoch = epoch;
+  }
+
+  /** Nodes below the mark are valid if they were recorded between the last
+   *  reset and the mark, all others only within the current epoch. */
+  bool is_valid(int32_t n, uint32_t n_epoch) const {
+    if (n < 0)
+      return false;
+    if ((size_t)n < mark_nodes)
+      return (uint32_t)(n_epoch - reset_epoch) <= (uint32_t)(mark_epoch - reset_epoch);
+    return n_epoch == epoch && (size_t)n < nodes.size();
+  }
+
+  /** Reserve a slot of frozen for the tangents of node n, which are filled in by the next flush(). */
+  int32_t freeze(int32_t n) {
+    const int w = width();
+    int32_t idx;
+    if (free_frozen.empty()) {
+      frozen.resize(frozen.size() + w);
+      idx = frozen.size() / w - 1;
+    } else {
+      idx = free_frozen.back();
+      free_frozen.pop_back();
+    }
+    pending.push_back({n, idx});
+    slot_pending.resize(frozen.size() / w);
+    slot_pending[idx] = true;
+    return idx;
+  }
+
+  /** Hand a slot of frozen back for reuse, dropping its pending tangents. */
+  void release(int32_t idx) {
+    if (slot_pending[idx]) {
+      std::erase_if(pending, [idx](auto &p) { return p.slot == idx; });
+      slot_pending[idx] = false;
+    }
+    free_frozen.push_back(idx);
+  }
+
+  /** Fill the slots of all pending frozen values by a single sweep over the
+   *  tape: a reverse sweep with one adjoint per value if there are at most
+   *  width() values, otherwise a forward sweep with the tangents wrt. all
+   *  inputs per node. Where the adjoints or tangents up to the highest pending
+   *  node would exceed max_flush_adjoints, the values respectively the input
+   *  dimensions are swept in groups. */
+  void flush() {
+    if (pending.empty())
+      return;
+
+    int32_t top = 0;
+    for (auto &p : pending)
+      top = std::max(top, p.node);
+
+    if (pending.size() > (size_t)width())
+      flush_forward(top);
+    else
+      flush_reverse();
+
+    for (auto &p : pending)
+      slot_pending[p.slot] = false;
+    pending.clear();
+  }
+
+  /** Tangents of node n wrt. all inputs via a reverse sweep. The result of the last sweep is cached. */
+  const double *tangents(int32_t n) {
+    if (n == cached_node && version == cached_version)
+      return cached_tang.data();
+
+    adj.assign(n + 1, 0.0);
+    adj[n] = 1.0;
+    for (int32_t i = n; i >= 0; i--) {
+      double a = adj[i];
+      if (a == 0.0)
+        continue;
+
+      const node &nd = nodes[i];
+      if (nd.arg[0] >= 0)
+        adj[nd.arg[0]] += a * nd.partial[0];
+      if (nd.arg[1] >= 0)
+        adj[nd.arg[1]] += a * nd.partial[1];
+    }
+
+    cached_tang.assign(width(), 0.0);
+    for (auto &s : seeds)
+      if (s.node <= n)
+        cached_tang[s.dim] += adj[s.node] * s.weight;
+
+    cached_node = n;
+    cached_version = version;
+    return cached_tang.data();
+  }
+
+private:
+  /** Forward sweep over nodes 0 to top, tangents of node i at sweep[i * dims]. */
+  void flush_forward(int32_t top) {
+    const int w = width();
+    const size_t group = std::clamp(max_flush_adjoints / (top + 1), (size_t)1, (size_t)w);
+
+    for (size_t first = 0; first < (size_t)w; first += group) {
+      const size_t dims = std::min(group, w - first);
+
+      sweep.assign((size_t)(top + 1) * dims, 0.0);
+      for (auto &sd : seeds)
+        if (sd.node <= top && (size_t)sd.dim >= first && (size_t)sd.dim < first + dims)
+          sweep[(size_t)sd.node * dims + sd.dim - first] += sd.weight;
+
+      for (int32_t i = 0; i <= top; i++) {
+        double *t = &sweep[(size_t)i * dims];
+        const node &nd = nodes[i];
+        for (int j = 0; j < 2; j++) {
+          if (nd.arg[j] < 0 || nd.partial[j] == 0.0)
+            continue;
+          const double *a = &sweep[(size_t)nd.arg[j] * dims];
+          const double d = nd.partial[j];
+          for (size_t k = 0; k < dims; k++)
+            t[k] += a[k] * d;
+        }
+      }
+
+      for (auto &p : pending)
+        std::copy_n(&sweep[(size_t)p.node * dims], dims, frozen.begin() + (size_t)p.slot * w + first);
+    }
+  }
+
+  /** Reverse sweep with one adjoint per pending value, adjoint l of node i at sweep[i * lanes + l]. */
+  void flush_reverse() {
+    const int w = width();
+    std::sort(pending.begin(), pending.end(), [](auto &a, auto &b) { return a.node < b.node; });
+
+    for (size_t first = 0; first < pending.size();) {
+      // values of similar height share a sweep, the first one always fits
+      size_t lanes = 1;
+      while (first + lanes < pending.size() &&
+             (size_t)(pending[first + lanes].node + 1) * (lanes + 1) <= max_flush_adjoints)
+        lanes++;
+      const pending_freeze *p = &pending[first];
+      const int32_t n = p[lanes - 1].node;
+
+      sweep.assign((size_t)(n + 1) * lanes, 0.0);
+      for (size_t l = 0; l < lanes; l++)
+        sweep[(size_t)p[l].node * lanes + l] = 1.0;
+
+      for (int32_t i = n; i >= 0; i--) {
+        const double *a = &sweep[(size_t)i * lanes];
+        bool active = false;
+        for (size_t l = 0; l < lanes; l++)
+          active |= a[l] != 0.0;
+        if (!active)
+          continue;
+
+        const node &nd = nodes[i];
+        for (int j = 0; j < 2; j++) {
+          if (nd.arg[j] < 0)
+            continue;
+          double *b = &sweep[(size_t)nd.arg[j] * lanes];
+          const double d = nd.partial[j];
+          for (size_t l = 0; l < lanes; l++)
+            b[l] += a[l] * d;
+        }
+      }
+
+      for (size_t l = 0; l < lanes; l++)
+        std::fill_n(frozen.begin() + (size_t)p[l].slot * w, w, 0.0);
+      for (auto &sd : seeds) {
+        if (sd.node > n)
+          continue;
+        const double *a = &sweep[(size_t)sd.node * lanes];
+        for (size_t l = 0; l < lanes; l++)
+          frozen[(size_t)p[l].slot * w + sd.dim] += a[l] * sd.weight;
+      }
+
+      first += lanes;
+    }
+  }
+
+  std::vector<double> sweep;
+  std::vector<double> adj;
+  std::vector<double> cached_tang;
+  int32_t cached_node = -1;
+  uint64_t version = 0;
+  uint64_t cached_version = 0;
+};
+
+#define rv_adouble_t rv_adouble<num_tang_, enable_ad_>
+
+template <int num_tang_, bool enable_ad_ = ENABLE_AD_DEFAULT> class rv_adouble {
+public:
+  static const int num_tangents = num_tang_; // for external access
+
+  static inline thread_local rv_tape<num_tang_> tape;
+
+  /** Number of tangent components, fixed at compile time or, for num_tang_ < 0, at startup. */
+  static int width() { return tang_width<num_tang_>::get(); }
+  static void set_width(int n) { tang_width<num_tang_>::set(n); }
+
+  double val;
+
+  mutable int32_t node = -1;  // -1: passive
+  mutable uint32_t epoch = 0;
+  int32_t frozen_idx = -1;    // offset / width() into tape.frozen, -1: not frozen
+  uint32_t frozen_epoch = 0;  // tape.reset_epoch when frozen, older slots belong to a previous tape
+
+  /** Whether our tangent is stored in a slot of tape.frozen filled since the last reset. */
+  bool is_frozen() const { return frozen_idx >= 0 && frozen_epoch == tape.reset_epoch; }
+
+  /** Index of this value's node on the current tape, -1 if passive. Frozen
+   *  values are re-entered onto the tape as leaves on first use. */
+  int32_t active_node() const {
+    if (!enable_ad_)
+      return -1;
+
+    if (tape.is_valid(node, epoch))
+      return node;
+
+    node = -1;
+    if (!is_frozen())
+      return -1;
+
+    if (tape.slot_pending[frozen_idx])
+      tape.flush();
+    node = tape.push(-1, 0.0);
+    epoch = tape.epoch;
+    const double *t = &tape.frozen[(size_t)frozen_idx * width()];
+    for (int k = 0, n_tang = width(); k < n_tang; k++)
+      if (t[k] != 0.0)
+        tape.push_seed(node, k, t[k]);
+    return node;
+  }
+
+  /** Make this value the result of an operation with the given arguments and partials. */
+  void record(int32_t a, double da, int32_t b = -1, double db = 0.0) {
+    frozen_idx = -1;
+    if (a < 0 && b < 0) {
+      node = -1;
+      return;
+    }
+    node = tape.push(a, da, b, db);
+    epoch = tape.epoch;
+  }
+
+  /** Make this the result of a unary function of x with value v and derivative d. */
+  void set_unary(const rv_adouble_t &x, double v, double d) {
+    int32_t n = x.active_node();
+    val = v;
+    record(n, d);
+  }
+
+  /** Add s times the tangent of x to our tangent, leaving the value untouched. */
+  void add_tang(const rv_adouble_t &x, double s) {
+    int32_t nx = x.active_node();
+    if (nx < 0)
+      return;
+    record(active_node(), 1.0, nx, s);
+  }
+
+  void add_tang(const rv_adouble_t &x, double sx, const rv_adouble_t &y, double sy) {
+    add_tang(x, sx);
+    add_tang(y, sy);
+  }
+
+  static void tape_reset() { tape.reset(); }
+  static void tape_mark() { tape.mark(); }
+  static void tape_rewind() { tape.rewind(); }
+
+  /** Store the dense tangent outside of the tape so that it survives rewinds.
+   *  The tangents are computed on the next access, together with those of all
+   *  values frozen in the meantime. */
+  void freeze() {
+    if (!enable_ad_ || is_frozen() || !tape.is_valid(node, epoch))
+      return;
+
+    frozen_idx = tape.freeze(node);
+    frozen_epoch = tape.reset_epoch;
+    node = -1;
+  }
+
+  /** Drop the tangent and hand a frozen slot back to the tape for reuse.
+   *  Only the owner of a frozen value may release it, copies share the slot. */
+  void release() {
+    if (is_frozen())
+      tape.release(frozen_idx);
+    clear_tang();
+  }
+
+  void mark_set() { return; }
+  void mark_set(const rv_adouble_t &other) { return; };
+
+  void clear_tang() {
+    node = -1;
+    frozen_idx = -1;
+  }
+
+  void init_val(double x) { val = x; };
+
+  void become(const rv_adouble_t &&other) { *this = other; }
+
+  rv_adouble(double x) { val = x; }
+
+  rv_adouble() : rv_adouble(0.0) {}
+
+  rv_adouble_t &operator=(double other) {
+    val = other;
+    clear_tang();
+    return *this;
+  }
+
+  double get_val() const { return val; }
+
+  double get_tang(int k) const {
+    if (!enable_ad_)
+      return 0.0;
+
+    if (tape.is_valid(node, epoch))
+      return tape.tangents(node)[k];
+
+    if (is_frozen()) {
+      if (tape.slot_pending[frozen_idx])
+        tape.flush();
+      return tape.frozen[(size_t)frozen_idx * width() + k];
+    }
+
+    return 0.0;
+  }
+
+  /** Overwrite the tangent wrt. input dimension k. On the most recent leaf,
+   *  this adjusts the seed in place, otherwise a new leaf is appended. */
+  void set_tang(int k, double a) {
+    if (!enable_ad_)
+      return;
+
+    int32_t n = active_node();
+    if (n >= 0 && (size_t)n == tape.nodes.size() - 1 && tape.nodes[n].arg[0] == -1 && tape.nodes[n].arg[1] == -1) {
+      for (size_t s = tape.seeds.size(); s > 0 && tape.seeds[s - 1].node == n; s--) {
+        if (tape.seeds[s - 1].dim == k) {
+          tape.flush(); // pending values may depend on the seed
+          tape.seeds[s - 1].weight = a;
+          tape.invalidate();
+          return;
+        }
+      }
+      tape.push_seed(n, k, a);
+      return;
+    }
+
+    double prev = n >= 0 ? get_tang(k) : 0.0;
+    record(n, 1.0);
+    if (node < 0) {
+      node = tape.push(-1, 0.0);
+      epoch = tape.epoch;
+    }
+    tape.push_seed(node, k, a - prev);
+  }
+
+  /** Set the tangents wrt. all input dimensions at once. */
+  void set_full_tang(const double *t) {
+    if (!enable_ad_)
+      return;
+
+    node = tape.push(-1, 0.0);
+    epoch = tape.epoch;
+    frozen_idx = -1;
+    for (int k = 0, n = width(); k < n; k++)
+      if (t[k] != 0.0)
+        tape.push_seed(node, k, t[k]);
+  }
+
+  bool has_tang() const { return enable_ad_ && (tape.is_valid(node, epoch) || is_frozen()); }
+
+  rv_adouble_t ipow(int p) const { return ::ipow(*this, p); }
+
+#define RV_ADOUBLE_BINARY_OP(OP_NAME, VAL_EXPR_A_A, DA_A_A, DB_A_A, VAL_EXPR_A_D, DA_A_D) \
+  rv_adouble_t OP_NAME(const rv_adouble_t &other) const {                     \
+    rv_adouble_t r;                                                            \
+    const double a = val, b = other.val;                                       \
+    r.val = VAL_EXPR_A_A;                                                      \
+    int32_t na = active_node(), nb = other.active_node();                      \
+    if (na >= 0 || nb >= 0)                                                    \
+      r.record(na, DA_A_A, nb, DB_A_A);                                        \
+    return r;                                                                  \
+  }                                                                            \
+  rv_adouble_t OP_NAME(double other) const {                                  \
+    rv_adouble_t r;                                                            \
+    const double a = val, b = other;                                           \
+    r.val = VAL_EXPR_A_D;                                                      \
+    int32_t na = active_node();                                                \
+    if (na >= 0)                                                               \
+      r.record(na, DA_A_D);                                                    \
+    return r;                                                                  \
+  }
+
+  RV_ADOUBLE_BINARY_OP(operator+, a + b, 1.0, 1.0, a + b, 1.0);
+  RV_ADOUBLE_BINARY_OP(operator-, a - b, 1.0, -1.0, a - b, 1.0);
+  RV_ADOUBLE_BINARY_OP(operator*, a * b, b, a, a * b, b);
+  RV_ADOUBLE_BINARY_OP(operator/, a / b, 1.0 / b, -a / (b * b), a / b, 1.0 / b);
+  RV_ADOUBLE_BINARY_OP(atan2, std::atan2(a, b), b / (a * a + b * b), -a / (a * a + b * b),
+                       std::atan2(a, b), b / (a * a + b * b));
+  RV_ADOUBLE_BINARY_OP(powc, std::pow(a, b), (assert(false), 0.0), 0.0,
+                       std::pow(a, b), b * std::pow(a, b - 1));
+
+  void operator+=(const rv_adouble_t &other) { *this = *this + other; }
+  void operator-=(const rv_adouble_t &other) { *this = *this - other; }
+  void operator*=(const rv_adouble_t &other) { *this = *this * other; }
+  void operator/=(const rv_adouble_t &other) { *this = *this / other; }
+  void operator+=(double other) { val += other; }
+  void operator-=(double other) { val -= other; }
+  void operator*=(double other) { *this = *this * other; }
+  void operator/=(double other) { *this = *this / other; }
+
+  rv_adouble_t operator-() const {
+    rv_adouble_t r;
+    r.val = -val;
+    int32_t n = active_node();
+    if (n >= 0)
+      r.record(n, -1.0);
+    return r;
+  }
+
+  bool operator<(double other) const { return val < other; };
+  bool operator<=(double other) const { return val <= other; };
+  bool operator>(double other) const { return val > other; };
+  bool operator>=(double other) const { return val >= other; };
+  bool operator==(double other) const { return val == other; }
+  bool operator!=(double other) const { return val != other; }
+
+  bool operator<(const rv_adouble_t &other) const { return val < other.val; };
+  bool operator<=(const rv_adouble_t &other) const { return val <= other.val; };
+  bool operator>(const rv_adouble_t &other) const { return val > other.val; };
+  bool operator>=(const rv_adouble_t &other) const { return val >= other.val; };
+  bool operator==(const rv_adouble_t &other) const { return val == other.val; }
+  bool operator!=(const rv_adouble_t &other) const { return val != other.val; }
+
+  explicit operator int() { return (int)val; }
+};
+
+template <int num_tang_, bool enable_ad_>
+bool operator<(double lhs, const rv_adouble_t &rhs) {
+  return rhs > lhs;
+};
+template <int num_tang_, bool enable_ad_>
+bool operator<=(double lhs, const rv_adouble_t &rhs) {
+  return rhs >= lhs;
+};
+template <int num_tang_, bool enable_ad_>
+bool operator>(double lhs, const rv_adouble_t &rhs) {
+  return rhs < lhs;
+};
+template <int num_tang_, bool enable_ad_>
+bool operator>=(double lhs, const rv_adouble_t &rhs) {
+  return rhs <= lhs;
+};
+template <int num_tang_, bool enable_ad_>
+bool operator==(double lhs, const rv_adouble_t &rhs) {
+  return rhs == lhs;
+}
+template <int num_tang_, bool enable_ad_>
+bool operator!=(double lhs, const rv_adouble_t &rhs) {
+  return rhs != lhs;
+}
+
+template <int num_tang_, bool enable_ad_>
+rv_adouble_t operator+(double lhs, const rv_adouble_t &rhs) {
+  return rhs + lhs;
+}
+template <int num_tang_, bool enable_ad_>
+rv_adouble_t operator-(double lhs, const rv_adouble_t &rhs) {
+  rv_adouble_t r;
+  r.val = lhs - rhs.val;
+  int32_t n = rhs.active_node();
+  if (n >= 0)
+    r.record(n, -1.0);
+  return r;
+}
+template <int num_tang_, bool enable_ad_>
+rv_adouble_t operator*(double lhs, const rv_adouble_t &rhs) {
+  return rhs * lhs;
+}
+template <int num_tang_, bool enable_ad_>
+rv_adouble_t operator/(double lhs, const rv_adouble_t &rhs) {
+  rv_adouble_t r;
+  r.val = lhs / rhs.val;
+  int32_t n = rhs.active_node();
+  if (n >= 0)
+    r.record(n, -lhs / (rhs.val * rhs.val));
+  return r;
+}
+
+#define RV_ADOUBLE_UNARY_OP(FUNC, DERIV_EXPR)                                  \
+  template <int num_tang_, bool enable_ad_>                                    \
+  rv_adouble_t FUNC(const rv_adouble_t &x) {                                   \
+    rv_adouble_t r;                                                            \
+    r.val = FUNC(x.val);                                                       \
+    int32_t n = x.active_node();                                               \
+    if (n >= 0)                                                                \
+      r.record(n, DERIV_EXPR);                                                 \
+    return r;                                                                  \
+  }
+
+RV_ADOUBLE_UNARY_OP(exp, r.val); // r.val == exp(x.val)
+RV_ADOUBLE_UNARY_OP(sin, cos(x.val));
+RV_ADOUBLE_UNARY_OP(cos, -sin(x.val));
+RV_ADOUBLE_UNARY_OP(sqrt, 1.0 / (2.0 * r.val)); // r.val == sqrt(x.val)
+RV_ADOUBLE_UNARY_OP(log, 1.0 / x.val);
+RV_ADOUBLE_UNARY_OP(erf, 2.0 * exp(-(x.val * x.val)) / sqrt(M_PI));
+RV_ADOUBLE_UNARY_OP(tanh, 1.0 - r.val * r.val); // r.val == tanh(x.val)
+
+template <int num_tang_, bool enable_ad_>
+rv_adouble_t atan2(const rv_adouble_t &a, const rv_adouble_t &b) {
+  return a.atan2(b);
+}
+template <int num_tang_, bool enable_ad_>
+rv_adouble_t powc(const rv_adouble_t &a, const double b) {
+  return a.powc(b);
+}
+
+typedef rv_adouble<num_inputs> adouble;
@@ -0,0 +1,55 @@
+/* Copyright 2023, 2024 Philipp Andelfinger, Justin Kreikemeyer
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the “Software”), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE. */
+
+/** Loops over dense tangent blocks of n components shared by fw_adouble and
+ * avec. With -DPORTABLE, they are compiled for several x86-64 feature levels
+ * and dispatched at run time (see multiversion.hpp). The result may alias the
+ * operands.
+ */
+
+#pragma once
+
+#include "multiversion.hpp"
+
+/** r = a * x */
+MULTIVERSION_KERNEL(void, tang_scale, (double *r, double a, const double *x, int n), (r, a, x, n)) {
+  for (int i = 0; i < n; i++)
+    r[i] = a * x[i];
+}
+
+/** r += a * x */
+MULTIVERSION_KERNEL(void, tang_add_scaled, (double *r, double a, const double *x, int n), (r, a, x, n)) {
+  for (int i = 0; i < n; i++)
+    r[i] += a * x[i];
+}
+
+/** r = a * x + b * y */
+MULTIVERSION_KERNEL(void, tang_axpby, (double *r, double a, const double *x, double b, const double *y, int n),
+                    (r, a, x, b, y, n)) {
+  for (int i = 0; i < n; i++)
+    r[i] = a * x[i] + b * y[i];
+}
+
+/** r += a * x + b * y */
+MULTIVERSION_KERNEL(void, tang_add_axpby, (double *r, double a, const double *x, double b, const double *y, int n),
+                    (r, a, x, b, y, n)) {
+  for (int i = 0; i < n; i++)
+    r[i] += a * x[i] + b * y[i];
+}
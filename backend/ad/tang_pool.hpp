@@ -0,0 +1,83 @@
+/* Copyright 2023, 2024 Philipp Andelfinger, Justin Kreikemeyer
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the “Software”), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE. */
+
+/** Per-thread pool of dense tangent blocks. Blocks are grouped into
+ * power-of-two size classes and recycled through intrusive free lists, so that
+ * obtaining a block is a pointer pop after warm-up. Blocks are never returned
+ * to the OS, cleanup is left to the OS at exit.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdlib.h>
+
+class tang_pool {
+public:
+  static constexpr size_t block_alignment = 64; // cache line, also suits AVX-512 loads
+
+  static tang_pool &local() {
+    static thread_local tang_pool pool;
+    return pool;
+  }
+
+  /** A block that holds at least n doubles. */
+  double *alloc(size_t n) {
+    int c = size_class(n);
+    free_block *b = free_lists[c];
+    if (b != nullptr) {
+      free_lists[c] = b->next;
+      return (double *)b;
+    }
+
+    size_t bytes = (sizeof(double) << c) < block_alignment ? block_alignment : sizeof(double) << c;
+    return (double *)aligned_alloc(block_alignment, bytes);
+  }
+
+  /** Return a block obtained via alloc(n) to the pool. */
+  void free(double *p, size_t n) {
+    int c = size_class(n);
+    free_block *b = (free_block *)p;
+    b->next = free_lists[c];
+    free_lists[c] = b;
+  }
+
+private:
+  struct free_block {
+    free_block *next;
+  };
+
+  static constexpr int num_classes = 48;
+  free_block *free_lists[num_classes] = {};
+
+  static int size_class(size_t n) { return n <= 1 ? 0 : 64 - __builtin_clzll(n - 1); }
+};
+
+/** Number of tangent components of adouble<num_tang_>. A negative num_tang_
+ * denotes a width chosen at startup via set(), before any tangents exist. A
+ * compile-time width can be narrowed the same way. */
+template <int num_tang_> struct tang_width {
+  static inline int active = num_tang_ < 0 ? 0 : num_tang_;
+
+  static int get() { return active; }
+
+  static void set(int n) { active = n; }
+};
@@ -0,0 +1,123 @@
+/** All estimators in one binary, the estimator is selected at runtime via --backend.
+ *
+ *  Copyright 2023, 2024 Philipp Andelfinger, Justin Kreikemeyer
+ *  
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ *  and associated documentation files (the “Software”), to deal in the Software without
+ *  restriction, including without limitation the rights to use, copy, modify, merge, publish,
+ *  distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *   
+ *    The above copyright notice and this permission notice shall be included in all copies or
+ *    substantial portions of the Software.
+ *    
+ *    THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ *    INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ *    PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ *    ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ *    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *    SOFTWARE.
+ */
+
+#include "crisp/discograd.hpp"
+#include "polyak_gradient_oracle/discograd.hpp"
+#include "reinforce/discograd.hpp"
+#include "rloo/discograd.hpp"
+#include "discograd_gradient_oracle/discograd.hpp"
+
+using namespace std;
+
+/** Dispatches to the estimator selected via --backend, DGO by default. The
+ *  estimators share the state of DiscoGradBase. The calls inserted by the DGO
+ *  transformation do nothing for the other estimators, so that the program
+ *  runs as before its transformation. */
+template<int num_inputs>
+class DiscoGrad final : public Crisp<num_inputs>, public PolyakGradientOracle<num_inputs>, public Reinforce<num_inputs>,
+                        public Rloo<num_inputs>, public DiscoGradGradientOracle<num_inputs> {
+private:
+  typedef DiscoGradGradientOracle<num_inputs> Dgo;
+
+  enum estimator { crisp, pgo, reinforce, rloo, dgo };
+  static constexpr const char *names[] = { Crisp<num_inputs>::name, PolyakGradientOracle<num_inputs>::name,
+                                           Reinforce<num_inputs>::name, Rloo<num_inputs>::name, Dgo::name };
+  estimator selected = dgo;
+
+public:
+  DiscoGrad(int argc, char **argv, bool debug=false)
+    : DiscoGradBase<num_inputs>(argc, argv, debug), Crisp<num_inputs>(argc, argv, debug), PolyakGradientOracle<num_inputs>(argc, argv, debug),
+      Reinforce<num_inputs>(argc, argv, debug), Rloo<num_inputs>(argc, argv, debug), Dgo(argc, argv, debug) {
+    if (this->backend.empty())
+      return;
+
+    for (int e = crisp; e <= dgo; e++)
+      if (this->backend == names[e])
+        selected = (estimator)e;
+
+    if (this->backend != names[selected]) {
+      printf("unknown backend %s, expected one of crisp, pgo, reinforce, rloo, dgo, exiting\n", this->backend.c_str());
+      exit(1);
+    }
+  }
+
+  void estimate_(DiscoGradProgram<num_inputs> &program) {
+    switch (selected) {
+      case crisp: Crisp<num_inputs>::estimate_(program); break;
+      case pgo: PolyakGradientOracle<num_inputs>::estimate_(program); break;
+      case reinforce: Reinforce<num_inputs>::estimate_(program); break;
+      case rloo: Rloo<num_inputs>::estimate_(program); break;
+      case dgo: Dgo::estimate_(program); break;
+    }
+  }
+
+  double derivative(int dim) const {
+    switch (selected) {
+      case crisp: return Crisp<num_inputs>::derivative(dim);
+      case pgo: return PolyakGradientOracle<num_inputs>::derivative(dim);
+      case reinforce: return Reinforce<num_inputs>::derivative(dim);
+      case rloo: return Rloo<num_inputs>::derivative(dim);
+      default: return Dgo::derivative(dim);
+    }
+  }
+
+  double directional_derivative(int k) const {
+    switch (selected) {
+      case pgo: return PolyakGradientOracle<num_inputs>::directional_derivative(k);
+      case reinforce: return Reinforce<num_inputs>::directional_derivative(k);
+      case rloo: return Rloo<num_inputs>::directional_derivative(k);
+      default: return derivative(k);
+    }
+  }
+
+  bool differentiates() const { return selected == crisp || selected == dgo; }
+
+  template<uint64_t branch_pos>
+  void prepare_branch(adouble& cond) {
+    if (selected == dgo)
+      Dgo::template prepare_branch<branch_pos>(cond);
+  }
+
+  void prepare_branch(uint64_t branch_pos, adouble& cond) {
+    if (selected == dgo)
+      Dgo::prepare_branch(branch_pos, cond);
+  }
+
+  void end_block() {
+    if (selected == dgo)
+      Dgo::end_block();
+  }
+
+  void inc_branch_visit(uint64_t branch_pos) {
+    if (selected == dgo)
+      Dgo::inc_branch_visit(branch_pos);
+  }
+
+  void inc_branch_visits(uint64_t first, uint64_t last) {
+    if (selected == dgo)
+      Dgo::inc_branch_visits(first, last);
+  }
+
+  void inc_branch_visit(uint64_t branch_pos, bool cond_sign) {
+    if (selected == dgo)
+      Dgo::inc_branch_visit(branch_pos, cond_sign);
+  }
+};
@@ -21,48 +21,54 @@
 
 using namespace std;
 
-extern uint64_t global_branch_id;
-extern uint32_t branch_level;
+extern thread_local uint64_t global_branch_id;
+extern thread_local uint32_t branch_level;
 
 template<int num_inputs>
 class DiscoGradBase;
 
 template<int num_inputs>
-class DiscoGrad : public DiscoGradBase<num_inputs> {
+class Crisp : public virtual DiscoGradBase<num_inputs> {
+private:
+  double exp = 0.0;
+  input_array<double, num_inputs> deriv = make_input_array<double, num_inputs>(this->num_tangs);
+
 public:
-  DiscoGrad(int argc, char **argv, bool debug=false) : DiscoGradBase<num_inputs>(argc, argv, debug) {};
+  static constexpr const char *name = "crisp";
 
-  void estimate_(DiscoGradProgram<num_inputs> &program) {
-    this->sampling_rng.seed(random_device()());
-    for (uint64_t rep = 0; rep < this->num_replications; ++rep) {
+  Crisp(int argc, char **argv, bool debug=false) : DiscoGradBase<num_inputs>(argc, argv, debug) {};
 
-      if (!this->rs_mode)
-        this->current_seed = this->seed_dist(this->rep_seed_gen);
+  void estimate_(DiscoGradProgram<num_inputs> &program) {
+    exp = 0.0;
+    fill(deriv.begin(), deriv.end(), 0.0);
 
+    for (uint64_t rep = 0; rep < this->num_replications; ++rep) {
       for (uint64_t sample = 0; sample < this->num_samples; sample++) {
-        if (this->rs_mode)
-          this->current_seed = this->seed_dist(this->rep_seed_gen);
+        adouble::tape_rewind();
 
-        
-        array<adouble, num_inputs> pm_perturbed = this->parameters;
-        array<double, num_inputs> perturbation = {};
+        aparams pm_perturbed = this->parameters;
+        input_array<double, num_inputs> perturbation = make_input_array<double, num_inputs>(this->num_dims);
 
         if (this->stddev > 0) {
-          for (int dim = 0; dim < num_inputs; dim++) {
-            if (this->perturbation_dim == -1 || this->perturbation_dim == dim) {
-              perturbation[dim] = this->normal_dist(this->sampling_rng);
-            }
-
+          this->draw_perturbation(perturbation, rep, sample, this->stddev);
+          for (int dim = 0; dim < this->num_dims; dim++)
             pm_perturbed[dim] += perturbation[dim];
-          }
         }
 
-        this->rng.seed(this->current_seed);
+        this->seed_rng(rep, sample);
 
         adouble r = program.run(pm_perturbed);
-        this->exp_val += r;
+        exp += r.get_val();
+#ifdef ENABLE_AD
+        for (int dim = 0; dim < this->num_tangs; dim++)
+          deriv[dim] += r.get_tang(dim);
+#endif
       }
     }
-    this->exp_val /= this->num_replications * this->num_samples;
+    this->exp_val = exp / (this->num_replications * this->num_samples);
+    for (int dim = 0; dim < this->num_tangs; dim++)
+      deriv[dim] /= this->num_replications * this->num_samples;
   }
+
+  double derivative(int dim) const { return deriv[dim]; }
 };
@@ -22,34 +22,69 @@
 #pragma once
 
 #include <array>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <vector>
 #include <iostream>
 #include <limits>
+#include <memory>
+#include <mutex>
 #include <math.h>
 #include <float.h>
 #include <chrono>
 #include <ratio>
 #include <random>
 #include <stdlib.h>
+#include <thread>
 #include "args.h"
+#include "io.hpp"
+#include "optimizer.hpp"
+#include "philox.hpp"
+#include "server.hpp"
 
 using namespace std;
 
-/** Number of inputs to the program. This needs to be specified in the user program. */
+/** Number of inputs to the program. This needs to be specified in the user program.
+ *  If negative, the number is read from the --ni command-line option at startup, so that one
+ *  binary serves models of different sizes. */
 extern const int num_inputs;
 
 /* Compile-time options */
 
 // choose AD backend
-#if defined FW_AD
+#if defined FW_AD || defined RV_AD
   #define ENABLE_AD
 #else
   #undef ENABLE_AD
 #endif
 
-#include "ad/fw_ad.hpp"
+#if defined RV_AD
+  #include "ad/rv_ad.hpp"
+#else
+  #include "ad/fw_ad.hpp"
+#endif
 #include "ad/avec.hpp"
+#include "ad/amath.hpp"
+#include "ad/ablas.hpp"
+
+/** Per-input storage: a fixed-size array if the number of inputs is known at compile time. */
+template <typename T, int n>
+using input_array = conditional_t<(n < 0), vector<T>, array<T, (n < 0 ? 0 : n)>>;
+
+template <typename T, int n>
+input_array<T, n> make_input_array(int num_dims, const T &init = T()) {
+  input_array<T, n> a;
+  if constexpr (n < 0)
+    a.assign(num_dims, init);
+  else
+    a.fill(init);
+  return a;
+}
 
-typedef array<adouble, num_inputs> aparams;
+typedef input_array<adouble, num_inputs> aparams;
 
 template<int num_inputs>
 class DiscoGrad;
@@ -62,52 +97,216 @@ public:
   DiscoGradProgram(DiscoGrad<num_inputs> &_discograd) : _discograd(_discograd) { };
 
   virtual adouble run(aparams &p) = 0;
+
+  /** A copy of the program that runs on the given estimator, so that --nt threads can estimate
+   *  parameter combinations concurrently. Programs that do not support this return nullptr. */
+  virtual unique_ptr<DiscoGradProgram<num_inputs>> clone(DiscoGrad<num_inputs> &_discograd) const { return nullptr; }
 };
 
-/** Wrapper for a smoothly interpreted function that takes only the parameters read from stdin. */
+/** Wrapper for a smoothly interpreted function that takes only the parameters read from stdin.
+ *  The function may only be run concurrently (--nt) if it is declared thread-safe via concurrent,
+ *  i.e., if it does not modify global or function-local static state. */
 template<int num_inputs>
 class DiscoGradFunc : public DiscoGradProgram<num_inputs> {
 private:
   adouble (*func)(DiscoGrad<num_inputs>&, aparams&);
+  bool concurrent;
 public:
-  DiscoGradFunc(DiscoGrad<num_inputs> &_discograd, adouble (*func)(DiscoGrad<num_inputs>&, aparams&)) :
-                DiscoGradProgram<num_inputs>(_discograd), func(func) {}
+  DiscoGradFunc(DiscoGrad<num_inputs> &_discograd, adouble (*func)(DiscoGrad<num_inputs>&, aparams&), bool concurrent = false) :
+                DiscoGradProgram<num_inputs>(_discograd), func(func), concurrent(concurrent) {}
   adouble run(aparams &p) {
     return func(this->_discograd, p);
   }
+  unique_ptr<DiscoGradProgram<num_inputs>> clone(DiscoGrad<num_inputs> &_discograd) const {
+    if (!concurrent)
+      return nullptr;
+    return make_unique<DiscoGradFunc<num_inputs>>(_discograd, func, true);
+  }
 };
 
 /** Base class for different kinds of DiscoGrad estimators. */
 template<int num_inputs>
 class DiscoGradBase {
+public:
+  /** Settings of an estimation, initialized from the command line. */
+  struct Options {
+    int seed = 1;                 /**< Seed for the replications, -1: random. */
+    int perturbation_seed = -1;   /**< Seed for the perturbations, -1: random. */
+    uint64_t num_samples = 1;
+    uint64_t num_replications = 1;
+    double variance = 1;
+    int perturbation_dim = -1;    /**< Input dimension to perturb, -1: all. */
+    vector<double> directions;    /**< num_dirs x num_dims directions in --directions mode, empty: drawn at random. */
+  };
+
+  /** Outcome of an estimation. */
+  struct Result {
+    double expectation;
+    vector<double> derivatives;   /**< Per input or, in --directions mode, per direction. Empty without AD in crisp. */
+    vector<double> directions;    /**< The directions in --directions mode. */
+    uint64_t estimate_duration_us;
+  };
+
 protected: 
   bool debug;
+  int argc;    /**< The command line, to set up the estimators of further threads. */
+  char **argv;
   uint64_t num_param_combs = 1;
+  int num_threads = 1; /**< Number of threads estimating the parameter combinations concurrently. */
   uint64_t num_replications = 1;
   uint64_t num_samples = 1;
-  int seed_arg = 1;
+  Options cli_options; /**< Settings given on the command line. */
   int seed;
 
-  default_random_engine rep_seed_gen;  /**< For generating seeds for each replication */
-  default_random_engine sampling_rng; /**< To draw perturbations */
-  uniform_int_distribution<unsigned> seed_dist; /**< Seed generator. */
-  normal_distribution<double> normal_dist;
+  /** Streams of random numbers per replication and sample. */
+  enum rng_stream : uint32_t { program_stream, perturbation_stream, reference_stream, direction_stream };
+  unsigned perturbation_seed; /**< Seed for the perturbations of the current estimation. */
   double variance, stddev;
   int perturbation_dim = 1;
   bool rs_mode = false;
-  unsigned current_seed; /**< The seed for the current run of the program. */
   adouble exp_val = 0.0;     /**< The current expected value of the smoothed program. */
-  array<adouble, num_inputs> parameters;
+  int num_dims = num_inputs; /**< Number of inputs, fixed at startup if num_inputs is negative. */
+  int num_dirs = 0;          /**< Number of directions in --directions mode, 0: full gradient. */
+  int num_tangs;             /**< Number of tangent components: num_dirs in --directions mode, else num_dims. */
+  bool read_dirs = false;    /**< Whether the directions are read from stdin after the inputs. */
+  vector<double> directions; /**< num_dirs x num_dims, row-major */
+  string branch_profile_fname; /**< Where the DGO backend writes the visits per branch position, empty: no profiling. */
+  string backend; /**< Estimator selected via --backend, empty: the default. */
+  OptimizerOptions optimizer_options; /**< Settings of --optimize. */
+  string socket_path; /**< Where --serve accepts estimation requests, empty: no server. */
+  string in_format = "text", out_format = "text"; /**< Formats of the parameters and results, see io.hpp. */
+  string in_fname; /**< Where the parameters are read from, empty: stdin. */
+  unique_ptr<ParamInput> input; /**< Opened on the first read. */
+  bool num_param_combs_given = false; /**< Whether --nc was given, otherwise binary input determines it. */
+  bool results_started = false; /**< Whether the header of binary results was written. */
+  aparams parameters;
   uint64_t start_time_us; /**< Start time of estimation. */
   uint64_t estimate_duration_us; /**< Duration of estimation. */
-  /** Print the program expectation and derivatives to stdout. */
-  void print_results() const {
-    printf("estimation_duration: %ldus, %.2fs\n", estimate_duration_us, estimate_duration_us * 1e-6);
-    printf("expectation: %.10g\n", expectation());
+  static double custom_op_val(double x) { return x; }
+  static double custom_op_val(const adouble &x) { return x.get_val(); }
+  static bool custom_op_active(double x) { return false; }
+  static bool custom_op_active(const adouble &x) { return x.has_tang(); }
+  static void custom_op_add_tang(adouble &r, double x, double d) {}
+  static void custom_op_add_tang(adouble &r, const adouble &x, double d) { r.add_tang(x, d); }
+  /** The expectation and derivatives of the most recent estimation. */
+  Result result() const {
+    Result r;
+    r.expectation = expectation();
 #if not defined CRISP or defined ENABLE_AD
-    for (int dim = 0; dim < num_inputs; ++dim)
-      printf("derivative: %.10g\n", derivative(dim));
+    if (num_dirs == 0) {
+      for (int dim = 0; dim < num_dims; ++dim)
+        r.derivatives.push_back(derivative(dim));
+    } else {
+      for (int k = 0; k < num_dirs; ++k)
+        r.derivatives.push_back(directional_derivative(k));
+    }
 #endif
+    r.directions = directions;
+    r.estimate_duration_us = estimate_duration_us;
+    return r;
+  }
+  /** Write the program expectation and derivatives to stdout in the --out-format. */
+  void print_results(const Result &r) {
+    bool print_dirs = num_dirs > 0 && !read_dirs;
+    FILE *out = results_stream();
+    if (out_format == "bin") {
+      if (!results_started)
+        write_binary_header(out, r.derivatives.size(), print_dirs ? r.directions.size() : 0, num_param_combs);
+      results_started = true;
+      write_binary(out, &r.expectation, 1);
+      write_binary(out, &r.estimate_duration_us, 1);
+      write_binary(out, r.derivatives.data(), r.derivatives.size());
+      if (print_dirs)
+        write_binary(out, r.directions.data(), r.directions.size());
+      return;
+    }
+    if (out_format == "jsonl") {
+      fprintf(out, "{\"expectation\":");
+      write_json(out, r.expectation);
+      fprintf(out, ",\"derivatives\":");
+      write_json(out, r.derivatives.data(), r.derivatives.size());
+      if (print_dirs) {
+        fprintf(out, ",\"directions\":[");
+        for (int k = 0; k < num_dirs; k++) {
+          fprintf(out, k > 0 ? "," : "");
+          write_json(out, &r.directions[k * num_dims], num_dims);
+        }
+        fprintf(out, "]");
+      }
+      fprintf(out, ",\"estimation_duration_us\":%lu}\n", r.estimate_duration_us);
+      return;
+    }
+
+    printf("estimation_duration: %ldus, %.2fs\n", r.estimate_duration_us, r.estimate_duration_us * 1e-6);
+    printf("expectation: %.10g\n", r.expectation);
+    for (size_t k = 0; k < r.derivatives.size(); ++k) {
+      if (print_dirs) {
+        printf("direction:");
+        for (int dim = 0; dim < num_dims; dim++)
+          printf(" %.10g", r.directions[k * num_dims + dim]);
+        printf("\n");
+      }
+      printf("derivative: %.10g\n", r.derivatives[k]);
+    }
+  }
+  /** Take over the settings of an estimation. */
+  void apply_options(const Options &opts) {
+    num_samples = opts.num_samples;
+    num_replications = opts.num_replications;
+    variance = opts.variance;
+    stddev = sqrt(variance);
+    perturbation_dim = opts.perturbation_dim;
+
+    // enable "random search" mode
+    rs_mode = num_samples == 1;
+    if (rs_mode) {
+      num_samples = num_replications;
+      num_replications = 1;
+    }
+  }
+  /** Obtain the directions for --directions mode, either as given or as standard normal samples. */
+  void init_directions(const vector<double> &given) {
+    directions.resize((size_t)num_dirs * num_dims);
+    if (!given.empty()) {
+      if (given.size() != directions.size()) {
+        printf("program expects %d directions of %d values each, exiting\n", num_dirs, num_dims);
+        exit(1);
+      }
+      directions = given;
+    } else {
+      Philox4x32(this->seed, 0, 0, direction_stream).fill_normal(directions.data(), directions.size());
+    }
+  }
+  /** Start the program's random numbers for a run of the given replication and sample. Except in
+   *  random search mode, the samples of a replication share their random numbers. */
+  void seed_rng(uint64_t replication, uint64_t sample) {
+    rng.seed(this->seed, replication, rs_mode ? sample : 0, program_stream);
+  }
+  /** Draw the perturbation of a sample, normally distributed with standard deviation scale in the
+   *  dimensions selected by --pd and zero in the others. */
+  template <typename A> void draw_perturbation(A &perturbation, uint64_t replication, uint64_t sample, double scale) {
+    Philox4x32(perturbation_seed, replication, sample, perturbation_stream).fill_normal(perturbation.data(), num_dims);
+    for (int dim = 0; dim < num_dims; dim++)
+      perturbation[dim] = perturbation_dim == -1 || perturbation_dim == dim ? perturbation[dim] * scale : 0.0;
+  }
+  /** Seed the tangents of the inputs with the unit vectors or, in --directions mode, with the directions. */
+  void seed_tangents() {
+    if (num_dirs == 0) {
+      for (int dim = 0; dim < num_dims; dim++)
+        parameters[dim].set_tang(dim, 1);
+    } else {
+      for (int dim = 0; dim < num_dims; dim++)
+        for (int k = 0; k < num_dirs; k++)
+          if (directions[k * num_dims + dim] != 0.0)
+            parameters[dim].set_tang(k, directions[k * num_dims + dim]);
+    }
+  }
+  /** Projection of a gradient wrt. the inputs onto direction k. */
+  template <typename G> double project(const G &grad, int k) const {
+    double r = 0.0;
+    for (int dim = 0; dim < num_dims; dim++)
+      r += grad[dim] * directions[k * num_dims + dim];
+    return r;
   }
   uint64_t get_time_us() { return chrono::time_point_cast<chrono::microseconds>(chrono::system_clock::now()).time_since_epoch().count(); }
   /** Log the time when starting to estimate. */
@@ -115,7 +314,7 @@ protected:
   /** Calculate the duration of the estimation execution. */
   void stop_timer() { estimate_duration_us = get_time_us() - start_time_us; }
 public:
-  default_random_engine rng; /**< Random number generator to be used by the program. */
+  Philox4x32 rng; /**< Random number generator to be used by the program. */
   /** Initialize a new DiscoGrad program.
    * Reads the input parameters from stdin, according to the num_inputs.
    * Reads seed and number of replicaitons from argv 1-2. If seed == -1, a random seed is chosen.
@@ -123,54 +322,150 @@ public:
    * @param argv Standard input arguments.
    * @param debug Whether to print debugging information.
    */
-  DiscoGradBase(int argc, char **argv, bool debug=false) {
-    sampling_rng.seed(random_device()());
-
+  DiscoGradBase(int argc, char **argv, bool debug=false) : argc(argc), argv(argv) {
     string path(argv[0]);
-    args::ArgParser parser("Usage: " + path + " -s [seed = 1] --nc [#parameter combinations = 1] --nr [#replications = 1] --var [variance = 1] --pd [perturbation dimension = -1] --ns [#samples = 1]");
+    args::ArgParser parser("Usage: " + path + " -s [seed = 1] --ps [perturbation seed = -1] --nc [#parameter combinations = 1] --nt [#threads = 1] --nr [#replications = 1] --var [variance = 1] --pd [perturbation dimension = -1] --ns [#samples = 1] --ni [#inputs] --directions [#directions = 0] --read-directions --profile-branches [file] --backend [crisp|pgo|reinforce|rloo|dgo]"
+                            " --optimize [sgd|adam] --iterations [100] --lr [0.01] --lr-schedule [constant|inverse|exponential] --lr-decay [0]"
+                            " --lower [bound] --upper [bound] --checkpoint [file] --checkpoint-interval [10] --serve [socket path]"
+                            " --in-format [text|bin] --in-file [file] --out-format [text|bin|jsonl]");
 
     parser.option("s");
+    parser.option("ps");
     parser.option("nc");
+    parser.option("nt");
     parser.option("nr");
     parser.option("var");
     parser.option("pd");
     parser.option("ns");
+    parser.option("ni");
+    parser.option("directions");
+    parser.flag("read-directions");
+    parser.option("profile-branches");
+    parser.option("backend");
+    parser.option("optimize");
+    parser.option("iterations");
+    parser.option("lr");
+    parser.option("lr-schedule");
+    parser.option("lr-decay");
+    parser.option("lower");
+    parser.option("upper");
+    parser.option("checkpoint");
+    parser.option("checkpoint-interval");
+    parser.option("serve");
+    parser.option("in-format");
+    parser.option("in-file");
+    parser.option("out-format");
 
     parser.parse(argc, argv);
 
+    if (parser.found("ni"))
+      num_dims = stoi(parser.value("ni"));
+
+    if (num_inputs >= 0 && num_dims != num_inputs) {
+      printf("program was compiled for %d inputs, exiting\n", num_inputs);
+      exit(1);
+    }
+    if (num_dims < 0) {
+      printf("program expects the number of inputs via --ni, exiting\n");
+      exit(1);
+    }
+
+    if (parser.found("directions"))
+      num_dirs = stoi(parser.value("directions"));
+    read_dirs = parser.found("read-directions");
+
+    if (parser.found("profile-branches"))
+      branch_profile_fname = parser.value("profile-branches");
+
+    if (parser.found("backend"))
+      backend = parser.value("backend");
+
+    if (parser.found("optimize"))
+      optimizer_options.method = parser.value("optimize");
+    if (parser.found("iterations"))
+      optimizer_options.iterations = stoul(parser.value("iterations"));
+    if (parser.found("lr"))
+      optimizer_options.lr = stod(parser.value("lr"));
+    if (parser.found("lr-schedule"))
+      optimizer_options.schedule = parser.value("lr-schedule");
+    if (parser.found("lr-decay"))
+      optimizer_options.lr_decay = stod(parser.value("lr-decay"));
+    if (parser.found("lower"))
+      optimizer_options.lower = stod(parser.value("lower"));
+    if (parser.found("upper"))
+      optimizer_options.upper = stod(parser.value("upper"));
+    if (parser.found("checkpoint"))
+      optimizer_options.checkpoint_fname = parser.value("checkpoint");
+    if (parser.found("checkpoint-interval"))
+      optimizer_options.checkpoint_interval = stoul(parser.value("checkpoint-interval"));
+
+    if (parser.found("serve"))
+      socket_path = parser.value("serve");
+
+    if (parser.found("in-format"))
+      in_format = parser.value("in-format");
+    if (parser.found("in-file"))
+      in_fname = parser.value("in-file");
+    if (parser.found("out-format"))
+      out_format = parser.value("out-format");
+
+    if (in_format != "text" && in_format != "bin") {
+      printf("unknown input format %s, expected text or bin, exiting\n", in_format.c_str());
+      exit(1);
+    }
+    if (out_format != "text" && out_format != "bin" && out_format != "jsonl") {
+      printf("unknown output format %s, expected text, bin or jsonl, exiting\n", out_format.c_str());
+      exit(1);
+    }
+    results_stream(out_format != "text");
+
+    if (num_dirs < 0 || num_dirs > num_dims) {
+      printf("number of directions must be between 1 and the number of inputs, exiting\n");
+      exit(1);
+    }
+
+    // in --directions mode, each tangent component carries the derivative along one direction
+    num_tangs = num_dirs > 0 ? num_dirs : num_dims;
+    adouble::set_width(num_tangs);
+    parameters = make_input_array<adouble, num_inputs>(num_dims);
+
     if (parser.found("s"))
-      this->seed_arg = stoi(parser.value("s"));
+      cli_options.seed = stoi(parser.value("s"));
+
+    if (parser.found("ps"))
+      cli_options.perturbation_seed = stoi(parser.value("ps"));
 
-    if (parser.found("nc"))
+    num_param_combs_given = parser.found("nc");
+    if (num_param_combs_given)
       this->num_param_combs = stoi(parser.value("nc"));
 
-    if (parser.found("nr"))
-      this->num_replications = stoi(parser.value("nr"));
+    if (parser.found("nt"))
+      num_threads = stoi(parser.value("nt"));
 
-    variance = stddev = 1;
-    if (parser.found("var")) {
-      variance = stod(parser.value("var"));
-      stddev = sqrt(variance);
+    if (num_threads < 1) {
+      printf("number of threads must be positive, exiting\n");
+      exit(1);
+    }
+    if (num_threads > 1 && !branch_profile_fname.empty()) {
+      printf("branch profiling requires a single thread, exiting\n");
+      exit(1);
     }
 
-    perturbation_dim = -1;
-    if (parser.found("pd"))
-      perturbation_dim = stod(parser.value("pd"));
+    if (parser.found("nr"))
+      cli_options.num_replications = stoi(parser.value("nr"));
 
-    normal_dist = normal_distribution<>(0, stddev);
+    if (parser.found("var"))
+      cli_options.variance = stod(parser.value("var"));
+
+    if (parser.found("pd"))
+      cli_options.perturbation_dim = stod(parser.value("pd"));
 
-    num_samples = 1;
     if (parser.found("ns"))
-      num_samples = stoi(parser.value("ns"));
+      cli_options.num_samples = stoi(parser.value("ns"));
 
     this->debug = debug;
 
-    // enable "random search" mode
-    if (num_samples == 1) {
-      rs_mode = true;
-      num_samples = this->num_replications;
-      this->num_replications = 1;
-    }
+    apply_options(cli_options);
 
     if (debug) {
       printf("variance: %.10g\n", stddev * stddev);
@@ -179,33 +474,304 @@ public:
     }
   }
 
+  /** The source of the parameters, opened on first use. Without --nc, the number of parameter
+   *  combinations is taken from the header of binary input. */
+  ParamInput &param_input() {
+    if (input)
+      return *input;
+
+    input = make_unique<ParamInput>(in_format == "bin", in_fname);
+    if (input->is_binary()) {
+      const BinaryHeader &header = input->header;
+      uint32_t num_dir_values = num_dirs > 0 && read_dirs ? num_dirs * num_dims : 0;
+      if (header.num_values != (uint32_t)num_dims || header.num_direction_values != num_dir_values) {
+        printf("binary input holds %u parameters and %u direction values per combination, program expects %d and %u, exiting\n",
+               header.num_values, header.num_direction_values, num_dims, num_dir_values);
+        exit(1);
+      }
+      if (!num_param_combs_given)
+        num_param_combs = header.num_combinations;
+    }
+    return *input;
+  }
+
+  /** Read the parameters from stdin or the --in-file. */
+  void read_params(input_array<double, num_inputs> &params) {
+    if (!param_input().read(params.data(), num_dims)) {
+      printf("program expects %d parameters, exiting\n", num_dims);
+      exit(1);
+    }
+  }
+
+  /** Read the directions for one parameter combination in --read-directions mode. */
+  void read_directions(vector<double> &dirs) {
+    dirs.resize((size_t)num_dirs * num_dims);
+    if (!param_input().read(dirs.data(), dirs.size())) {
+      printf("program expects %d directions of %d values each, exiting\n", num_dirs, num_dims);
+      exit(1);
+    }
+  }
+
+  /** Estimate the expectation and gradient of the program for --nc parameter combinations read
+   *  from stdin, using the settings from the command line, print the results and exit. With
+   *  --nt, the combinations are read up front and estimated concurrently. With --optimize,
+   *  run the optimization starting from the parameters read from stdin instead. With --serve,
+   *  answer requests received over a socket until terminated. */
   void estimate(DiscoGradProgram<num_inputs> &program) {
+    if (!socket_path.empty())
+      serve(program, socket_path);
+
+    param_input();
+    auto params = make_input_array<double, num_inputs>(num_dims);
+    if (!optimizer_options.method.empty()) {
+      read_params(params);
+      optimize(program, params, cli_options, optimizer_options);
+      exit(0);
+    }
+
+    if (num_threads > 1) {
+      estimate_concurrently(program);
+      exit(0);
+    }
+
+    Options opts = cli_options;
+    for (uint64_t param_comb = 0; param_comb < num_param_combs; param_comb++) {
+      read_params(params);
+
+      if (num_dirs > 0 && read_dirs)
+        read_directions(opts.directions);
+
+      print_results(estimate(program, params, opts));
+    }
+    exit(0); // leave cleanup to OS, mostly not to pollute profiling results
+  }
+
+  /** Estimate the --nc parameter combinations, read up front from stdin, on --nt threads and print
+   *  the results in input order. Each thread runs its own estimator and copy of the program.
+   *  Random perturbation seeds are drawn in input order, so that they do not depend on the thread. */
+  void estimate_concurrently(DiscoGradProgram<num_inputs> &program) {
+    uint64_t num_workers = min<uint64_t>(num_threads, num_param_combs);
+    vector<unique_ptr<DiscoGrad<num_inputs>>> estimators;
+    vector<unique_ptr<DiscoGradProgram<num_inputs>>> programs;
+    for (uint64_t w = 0; w < num_workers; w++) {
+      estimators.push_back(make_unique<DiscoGrad<num_inputs>>(argc, argv, debug));
+      programs.push_back(program.clone(*estimators.back()));
+      if (programs.back() == nullptr) {
+        printf("program does not support concurrent estimation via clone(), exiting\n");
+        exit(1);
+      }
+    }
+
+    vector<input_array<double, num_inputs>> params(num_param_combs, make_input_array<double, num_inputs>(num_dims));
+    vector<Options> opts(num_param_combs, cli_options);
     for (uint64_t param_comb = 0; param_comb < num_param_combs; param_comb++) {
-      this->seed = this->seed_arg;
-      if (this->seed == -1)
-        this->seed = random_device()();
-
-      this->rep_seed_gen.seed(this->seed);
-      this->seed_dist = uniform_int_distribution<unsigned>(0, numeric_limits<unsigned>::max());
-
-      for (int dim = 0; dim < num_inputs; dim++) {
-        double p;
-        if (scanf("%lf", &p) != 1) {
-          printf("program expects %d parameters, exiting\n", num_inputs);
-          exit(1);
+      read_params(params[param_comb]);
+      if (num_dirs > 0 && read_dirs)
+        read_directions(opts[param_comb].directions);
+      if (opts[param_comb].perturbation_seed == -1)
+        opts[param_comb].perturbation_seed = random_device()() >> 1;
+    }
+
+    vector<Result> results(num_param_combs);
+    vector<bool> done(num_param_combs, false);
+    mutex done_mutex;
+    condition_variable done_cv;
+    atomic<uint64_t> next_param_comb = 0;
+
+    vector<thread> workers;
+    for (uint64_t w = 0; w < num_workers; w++) {
+      workers.emplace_back([&, w] {
+        DiscoGradBase<num_inputs> &estimator = *estimators[w];
+        for (uint64_t param_comb; (param_comb = next_param_comb++) < num_param_combs;) {
+          Result r = estimator.estimate(*programs[w], params[param_comb], opts[param_comb]);
+
+          lock_guard<mutex> lock(done_mutex);
+          results[param_comb] = std::move(r);
+          done[param_comb] = true;
+          done_cv.notify_all();
         }
-        parameters[dim] = p;
-        parameters[dim].set_tang(dim, 1);
+      });
+    }
+
+    // print each result as soon as those of the preceding combinations are printed
+    for (uint64_t param_comb = 0; param_comb < num_param_combs; param_comb++) {
+      unique_lock<mutex> lock(done_mutex);
+      done_cv.wait(lock, [&] { return done[param_comb]; });
+      Result r = std::move(results[param_comb]);
+      lock.unlock();
+      print_results(r);
+    }
+
+    for (auto &worker : workers)
+      worker.join();
+  }
+
+  /** Estimate the expectation and gradient of the program at the given parameters. Can be called
+   *  repeatedly on the same program, e.g., to keep an expensive setup across optimization steps. */
+  Result estimate(DiscoGradProgram<num_inputs> &program, const input_array<double, num_inputs> &params, const Options &opts) {
+    if ((int)params.size() != num_dims) {
+      printf("program expects %d parameters, exiting\n", num_dims);
+      exit(1);
+    }
+
+    apply_options(opts);
+
+    this->seed = opts.seed;
+    if (this->seed == -1)
+      this->seed = random_device()();
+
+    perturbation_seed = opts.perturbation_seed;
+    if (opts.perturbation_seed == -1)
+      perturbation_seed = random_device()();
+
+    adouble::tape_reset();
+    for (int dim = 0; dim < num_dims; dim++)
+      parameters[dim] = params[dim];
+
+    if (num_dirs > 0)
+      init_directions(opts.directions);
+
+    // estimators that do not differentiate via AD run on passive inputs
+    if (differentiates())
+      seed_tangents();
+    adouble::tape_mark(); // the seeded parameters survive the per-sample rewinds
+
+    this->exp_val = 0.0;
+
+    start_timer();
+    estimate_(program);
+    stop_timer();
+#ifdef AD_PROFILE
+    ad_profile::print_summary();
+    ad_profile::reset();
+#endif
+    return result();
+  }
+
+  /** Same as above, using the settings from the command line. */
+  Result estimate(DiscoGradProgram<num_inputs> &program, const input_array<double, num_inputs> &params) {
+    return estimate(program, params, cli_options);
+  }
+
+  /** Minimize the expectation of the program starting from params, which hold the final iterate
+   *  afterwards, printing the expectation of each iteration. In --directions mode, the gradient
+   *  is approximated from the derivatives along new standard normal directions in each iteration. */
+  void optimize(DiscoGradProgram<num_inputs> &program, input_array<double, num_inputs> &params, Options opts,
+                const OptimizerOptions &optimizer_opts) {
+    Optimizer optimizer(optimizer_opts, num_dims);
+    auto grad = make_input_array<double, num_inputs>(num_dims);
+    for (uint64_t iteration = 0; iteration < optimizer_opts.iterations; iteration++) {
+      if (num_dirs > 0) {
+        opts.directions.resize((size_t)num_dirs * num_dims);
+        Philox4x32(opts.seed, iteration, 0, direction_stream).fill_normal(opts.directions.data(), opts.directions.size());
+      }
+
+      Result r = estimate(program, params, opts);
+      printf("iteration: %lu, expectation: %.10g, estimation_duration: %ldus\n", iteration, r.expectation, r.estimate_duration_us);
+      if (r.derivatives.empty()) {
+        printf("the %s backend provides no derivatives, exiting\n", backend.empty() ? "selected" : backend.c_str());
+        exit(1);
       }
 
-      this->exp_val = 0.0;
+      if (num_dirs == 0) {
+        for (int dim = 0; dim < num_dims; dim++)
+          grad[dim] = r.derivatives[dim];
+      } else {
+        for (int dim = 0; dim < num_dims; dim++) {
+          grad[dim] = 0.0;
+          for (int k = 0; k < num_dirs; k++)
+            grad[dim] += r.derivatives[k] * r.directions[k * num_dims + dim] / num_dirs;
+        }
+      }
 
-      start_timer();
-      estimate_(program);
-      stop_timer();
-      print_results();
+      optimizer.checkpoint(iteration, r.expectation, params, num_dims);
+      optimizer.step(params, grad, num_dims);
     }
-    exit(0); // leave cleanup to OS, mostly not to pollute profiling results
+
+    for (int dim = 0; dim < num_dims; dim++)
+      printf("parameter: %.10g\n", params[dim]);
+  }
+
+  /** Answer the estimation requests of clients connecting to a Unix domain socket at path until
+   *  the process is terminated (see server.hpp for the protocol). The program and the estimator's
+   *  allocations are kept across requests. Each request carries all settings of the estimation
+   *  except for those fixed at startup, i.e., the number of inputs and of directions. */
+  [[noreturn]] void serve(DiscoGradProgram<num_inputs> &program, const string &path) {
+    EstimationServer server(path);
+    printf("serving on %s\n", path.c_str());
+    fflush(stdout);
+
+    auto params = make_input_array<double, num_inputs>(num_dims);
+    server.run([&](const ServerRequest &req, const double *values, vector<char> &out) {
+      ServerResponse resp = {ServerResponse::ok, 0, 0.0, 0, 0};
+      Result r;
+      if (req.num_params != (uint32_t)num_dims)
+        resp.status = ServerResponse::wrong_num_params;
+      else if (req.num_direction_values != 0 && req.num_direction_values != (uint64_t)num_dirs * num_dims)
+        resp.status = ServerResponse::wrong_num_direction_values;
+      else if (req.num_samples == 0 || req.num_replications == 0 || !(req.variance >= 0) ||
+               req.perturbation_dim < -1 || req.perturbation_dim >= num_dims)
+        resp.status = ServerResponse::invalid_options;
+
+      if (resp.status == ServerResponse::ok) {
+        Options opts;
+        opts.seed = req.seed;
+        opts.perturbation_seed = cli_options.perturbation_seed;
+        opts.num_samples = req.num_samples;
+        opts.num_replications = req.num_replications;
+        opts.variance = req.variance;
+        opts.perturbation_dim = req.perturbation_dim;
+        opts.directions.assign(values + num_dims, values + num_dims + req.num_direction_values);
+        for (int dim = 0; dim < num_dims; dim++)
+          params[dim] = values[dim];
+
+        r = estimate(program, params, opts);
+        resp.expectation = r.expectation;
+        resp.estimate_duration_us = r.estimate_duration_us;
+        resp.num_derivatives = r.derivatives.size();
+        resp.num_direction_values = r.directions.size();
+      }
+
+      out.insert(out.end(), (char *)&resp, (char *)&resp + sizeof(resp));
+      out.insert(out.end(), (char *)r.derivatives.data(), (char *)(r.derivatives.data() + r.derivatives.size()));
+      out.insert(out.end(), (char *)r.directions.data(), (char *)(r.directions.data() + r.directions.size()));
+    });
+  }
+
+  /** The settings given on the command line, to be adapted for in-process estimations. */
+  const Options &options() const { return cli_options; }
+
+  /** Apply a user-supplied function f to the values of the inputs (adoubles or doubles), obtaining
+   *  the tangents from the user-supplied derivative df instead of tracing f. df either maps the input
+   *  values to an indexable collection of the partial derivatives, or computes a Jacobian-vector product
+   *  from the input values followed by one direction per input. The transformations leave the call
+   *  untouched, so branches inside f and df are not smoothed. */
+  template <typename F, typename DF, typename... Ts>
+  adouble custom_op(F f, DF df, const Ts &...inputs) {
+    constexpr size_t n = sizeof...(Ts);
+    array<double, n> vals = {custom_op_val(inputs)...};
+    array<bool, n> active = {custom_op_active(inputs)...};
+
+    adouble r = apply(f, vals);
+
+    array<double, n> partials = {};
+    if constexpr (is_invocable_v<DF, decltype(custom_op_val(inputs))...>) {
+      auto jac = apply(df, vals);
+      for (size_t i = 0; i < n; i++)
+        partials[i] = jac[i];
+    } else {
+      // one product per active input with the unit direction yields its partial derivative
+      auto jvp = [&]<size_t... I>(index_sequence<I...>, size_t dir) {
+        return df(vals[I]..., (I == dir ? 1.0 : 0.0)...);
+      };
+      for (size_t i = 0; i < n; i++)
+        if (active[i])
+          partials[i] = jvp(make_index_sequence<n>(), i);
+    }
+
+    size_t i = 0;
+    (custom_op_add_tang(r, inputs, partials[i++]), ...);
+    return r;
   }
 
   /** Execute the DiscoGradProgram with a smoothed execution and estimate or calculate the gradient. */
@@ -214,17 +780,46 @@ public:
   double expectation() const { return exp_val.get_val(); }
   /** The (expected) program derivative for input dimension dim of the most recent estimation. */
   virtual double derivative(int dim) const { return exp_val.get_tang(dim); }
+  /** The (expected) program derivative along direction k of the most recent estimation in --directions mode.
+   *  Estimators that differentiate via AD obtain it from tangent component k, the others project
+   *  their gradient estimate. */
+  virtual double directional_derivative(int k) const { return derivative(k); }
+  /** Whether the estimator obtains the derivatives via AD, otherwise the inputs are not seeded with tangents. */
+  virtual bool differentiates() const { return true; }
+  /** Whether the estimator of the given name was selected via --backend or the choice was left to the default. */
+  bool selects_backend(const char *name) const { return backend.empty() || backend == name; }
 };
 
+/** The estimator chosen at compile time as DiscoGrad. */
+#define DISCOGRAD_BACKEND(Estimator)                                                              \
+  template<int num_inputs>                                                                         \
+  class DiscoGrad final : public Estimator<num_inputs> {                                           \
+  public:                                                                                          \
+    DiscoGrad(int argc, char **argv, bool debug=false)                                             \
+      : DiscoGradBase<num_inputs>(argc, argv, debug), Estimator<num_inputs>(argc, argv, debug) {   \
+      if (!this->selects_backend(Estimator<num_inputs>::name)) {                                   \
+        printf("program was compiled for the %s backend only, exiting\n", Estimator<num_inputs>::name); \
+        exit(1);                                                                                   \
+      }                                                                                            \
+    }                                                                                              \
+  };
+
 // choose smoothing variety
-#if defined PGO
+#if defined ALL_BACKENDS
+  #include "all_backends/discograd.hpp"
+#elif defined PGO
   #include "polyak_gradient_oracle/discograd.hpp"
+  DISCOGRAD_BACKEND(PolyakGradientOracle)
 #elif defined REINFORCE
   #include "reinforce/discograd.hpp"
+  DISCOGRAD_BACKEND(Reinforce)
 #elif defined RLOO
   #include "rloo/discograd.hpp"
+  DISCOGRAD_BACKEND(Rloo)
 #elif defined DGO
   #include "discograd_gradient_oracle/discograd.hpp"
+  DISCOGRAD_BACKEND(DiscoGradGradientOracle)
 #elif defined CRISP
   #include "crisp/discograd.hpp"
+  DISCOGRAD_BACKEND(Crisp)
 #endif
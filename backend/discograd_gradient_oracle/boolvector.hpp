@@ -2,9 +2,28 @@
 
 #include <vector>
 #include <cstdint>
+#include "multiversion.hpp"
 
 using namespace std;
 
+/** Number of differing bits of a and b among the bits set in both masks. */
+MULTIVERSION_KERNEL(uint64_t, masked_hamming_dist,
+                    (const uint64_t *a, const uint64_t *b, const uint64_t *a_mask, const uint64_t *b_mask, size_t n),
+                    (a, b, a_mask, b_mask, n)) {
+  uint64_t r = 0;
+  for (size_t i = 0; i < n; i++)
+    r += __builtin_popcountll((a[i] ^ b[i]) & a_mask[i] & b_mask[i]);
+  return r;
+}
+
+/** Number of differing bits of a and b. */
+MULTIVERSION_KERNEL(uint64_t, hamming_dist, (const uint64_t *a, const uint64_t *b, size_t n), (a, b, n)) {
+  uint64_t r = 0;
+  for (size_t i = 0; i < n; i++)
+    r += __builtin_popcountll(a[i] ^ b[i]);
+  return r;
+}
+
 class BoolVector {
 public:
   void resize(size_t bits) {
@@ -13,8 +32,15 @@ public:
     mask_vec.resize(v_offset + 1, 0);
   }
 
-  void inc_offset() {
-    b_size++;
+  /** Remove all bits, keeping the allocated memory. */
+  void clear() {
+    vec.clear();
+    mask_vec.clear();
+    b_size = 0;
+  }
+
+  void inc_offset(size_t bits = 1) {
+    b_size += bits;
   }
 
   void append(bool b) {
@@ -29,37 +55,21 @@ public:
     b_size++;
   }
 
+  /** Number of differing branch visits made by both paths. If the paths differ in length, e.g.,
+   *  due to recursion, the visits beyond the shorter one are not part of the comparison. */
   uint64_t abs_dist(BoolVector& other) {
-    assert(vec.size() == other.vec.size());
-    uint64_t r = 0;
-    for (size_t i = 0; i < vec.size(); i++) {
-      uint64_t& own_v = vec[i];
-      uint64_t& other_v = other.vec[i];
-      if (own_v == other_v)
-        continue;
-
-      uint64_t mask = mask_vec[i] & other.mask_vec[i];
-
-      if (mask == 0)
-        continue;
-
-      r += __builtin_popcountll((own_v ^ other_v) & mask);
-    }
-    return r;
+    return masked_hamming_dist(vec.data(), other.vec.data(), mask_vec.data(), other.mask_vec.data(),
+                               min(vec.size(), other.vec.size()));
   }
   
   uint64_t abs_dist_arbitrary_size(BoolVector& other) {
-    size_t max_size = max(vec.size(), other.vec.size());
-    uint64_t r = 0;
-    for (size_t i = 0; i < max_size; i++) {
-      uint64_t own_v = i < vec.size() ? vec[i] : 0;
-      uint64_t other_v = i < other.vec.size() ? other.vec[i] : 0;
-  
-      uint64_t x = own_v ^ other_v;
-      //printf("xor at %lu: %lu, popcount: %d\n", i, x, __builtin_popcountll(x));
-  
-      r += __builtin_popcountll(x);
-    }
+    size_t min_size = min(vec.size(), other.vec.size());
+    uint64_t r = hamming_dist(vec.data(), other.vec.data(), min_size);
+
+    // beyond the shorter vector, the bits of the longer one differ from zero
+    const vector<uint64_t> &longer = vec.size() > min_size ? vec : other.vec;
+    for (size_t i = min_size; i < longer.size(); i++)
+      r += __builtin_popcountll(longer[i]);
     return r;
   }
   
@@ -60,6 +60,8 @@
 #define DGO_MIN_INIT_TANG_CARR ((size_t)1)
 #endif
 
+// number of visits per sample preallocated for branch positions without a capacity
+// from the transformation, visits beyond a position's capacity go to a hash map
 #ifndef DGO_PREALLOC_BRANCH_DATA
 #define DGO_PREALLOC_BRANCH_DATA 10000000
 #endif
@@ -69,19 +71,19 @@
 const size_t dgo_fork_limit = DGO_FORK_LIMIT;
 using namespace std;
 
-extern uint64_t global_branch_id;
-extern uint32_t branch_level;
+extern thread_local uint64_t global_branch_id;
+extern thread_local uint32_t branch_level;
 extern const size_t dgo_fork_limit;
 
 template<int num_inputs>
 class DiscoGradBase;
 
 template<int num_inputs>
-class DiscoGrad : public DiscoGradBase<num_inputs> {
+class DiscoGradGradientOracle : public virtual DiscoGradBase<num_inputs> {
 private:
   static const size_t max_num_branch_conditions = DGO_NUM_BRANCH_COND;
 
-  typedef array<double, num_inputs> tangent_array;
+  typedef input_array<double, num_inputs> tangent_array;
 
   class smallest_carrier_list {
     public:
@@ -110,7 +112,7 @@ private:
         if (abs(cond.val) >= items[size - 1].cond.val)
           return;
         
-        items[size - 1].cond.clear_tang();
+        items[size - 1].cond.release();
         size--;
       }
 
@@ -129,17 +131,26 @@ private:
     }
 
     bool empty() { return size == 0; }
+
+    void clear() {
+      for (size_t i = 0; i < size; i++)
+        items[i].cond.release();
+      size = 0;
+    }
     carrier_cand& operator[](size_t i) { return items[i]; };
 
+    /** Keep the tangents of the given sample's carriers beyond the end of the sample. */
+    void freeze(uint32_t sample_id) {
+      for (size_t i = 0; i < size; i++)
+        if (items[i].sample_id == sample_id)
+          items[i].cond.freeze();
+    }
+
     private:
     carrier_cand items[max_num_carriers];
   };
 
-#ifdef __clang__
-  typedef __fp16 flt16;
-#else
-  typedef _Float16 flt16;
-#endif
+  typedef kdepp::kdemath::half flt16;
 
   class branch_data_ {
   public:
@@ -152,9 +163,28 @@ private:
     double kde_at_zero;
     double y_step = 0;
     vector<uint32_t> final_carriers_true, final_carriers_false;
+#ifdef RV_AD
+    bool carriers_pending = false; /**< carriers were added in the current sample and still need to be frozen */
+#endif
 
     branch_data_() : num_branch_visits(0), num_true_visits(0), num_false_visits(0) { };
 
+    /** Return to the state of a new branch, keeping the allocated memory. */
+    void reset() {
+      mean_cond = 0.0;
+      weight_tangent.reset();
+      branch_conditions.clear();
+      num_branch_visits = num_true_visits = num_false_visits = 0;
+      carriers_true.clear();
+      carriers_false.clear();
+      y_step = 0;
+      final_carriers_true.clear();
+      final_carriers_false.clear();
+#ifdef RV_AD
+      carriers_pending = false;
+#endif
+    }
+
     bool has_carriers() {
       return carriers_true.size >= DGO_MIN_NUM_TANG_CARR &&
              carriers_false.size >= DGO_MIN_NUM_TANG_CARR;
@@ -170,6 +200,11 @@ private:
 
       return bd;
     }
+
+    void reset() {
+      if (bd != nullptr)
+        bd->reset();
+    }
   };
 
   struct identity_hash {
@@ -177,9 +212,28 @@ private:
     auto operator()(uint64_t const& x) const noexcept -> uint64_t { return x; }
   };
 
+  /** Number of visits per sample for which each branch position has preallocated storage. */
+  static constexpr array<uint64_t, _discograd_max_branch_pos + 1> branch_capacity = [] {
+    array<uint64_t, _discograd_max_branch_pos + 1> c{};
+    for (int pos = 0; pos <= _discograd_max_branch_pos; pos++)
+      c[pos] = _discograd_branch_capacity[pos] > 0 ? _discograd_branch_capacity[pos] : DGO_PREALLOC_BRANCH_DATA;
+    return c;
+  }();
+
+  /** Offset of each branch position's storage in branch_data_storage, the total size at the end. */
+  static constexpr array<uint64_t, _discograd_max_branch_pos + 2> branch_offset = [] {
+    array<uint64_t, _discograd_max_branch_pos + 2> o{};
+    for (int pos = 0; pos <= _discograd_max_branch_pos; pos++)
+      o[pos + 1] = o[pos] + branch_capacity[pos];
+    return o;
+  }();
+
   uint64_t sample_branch_pos_visit[_discograd_max_branch_pos + 1];
+  uint64_t branch_storage_used[_discograd_max_branch_pos + 1] = {}; /**< leading entries of each position's storage touched in this estimation */
   ankerl::unordered_dense::map<uint64_t, branch_data_, identity_hash> gid_to_branch_data;
-  branch_data_wrapper **pos_to_branch_data;
+  branch_data_wrapper *branch_data_storage = nullptr;
+  ankerl::unordered_dense::map<uint64_t, branch_data_wrapper, identity_hash> overflow_branch_data; /**< visits beyond the capacity */
+  vector<uint64_t> branch_profile; /**< maximum visits per sample and branch position with --profile-branches */
 
 #if DGO_FORK_LIMIT == 0
   vector<pair<uint64_t, branch_data_ *>> flat_branch_data;
@@ -191,7 +245,11 @@ private:
   vector<tangent_array> dydxs;
 
 #if DGO_MIN_EXT_PERT == true
-  BoolVector *cond_signs;
+  vector<BoolVector> cond_signs;
+#endif
+
+#ifdef RV_AD
+  vector<branch_data_ *> pending_carrier_branches; /**< branches with carriers from the current sample */
 #endif
 
   uint64_t sample_id;
@@ -206,7 +264,12 @@ private:
 
   
 public:
-  DiscoGrad(int argc, char **argv, bool debug=false) : DiscoGradBase<num_inputs>(argc, argv, debug) {
+  static constexpr const char *name = "dgo";
+
+  DiscoGradGradientOracle(int argc, char **argv, bool debug=false) : DiscoGradBase<num_inputs>(argc, argv, debug) {
+    if (!this->selects_backend(name))
+      return;
+
     printf("DGO parameters: fork limit %ld, max. branch conditions %.0e,\n", dgo_fork_limit, (double)max_num_branch_conditions);
     printf("                min./max. tangent carriers %lu/%lu, min. initial tangent carriers: %lu\n", DGO_MIN_NUM_TANG_CARR, DGO_MAX_NUM_TANG_CARR, DGO_MIN_INIT_TANG_CARR);
     printf("                minimize external perturbations: %d\n", DGO_MIN_EXT_PERT);
@@ -250,6 +313,17 @@ public:
 #endif
   }
 
+  /** Count a visit to each of the branch positions first, ..., last, e.g., of the
+   *  branches in a block that is not taken. */
+  void inc_branch_visits(uint64_t first, uint64_t last) {
+    for (uint64_t branch_pos = first; branch_pos <= last; branch_pos++)
+      sample_branch_pos_visit[branch_pos]++;
+
+#if DGO_MIN_EXT_PERT == true
+    cond_signs[sample_id].inc_offset(last - first + 1);
+#endif
+  }
+
   void inc_branch_visit(uint64_t branch_pos, bool cond_sign) {
     sample_branch_pos_visit[branch_pos]++;
 
@@ -258,30 +332,31 @@ public:
 #endif
   }
 
-#if DGO_PREALLOC_BRANCH_DATA > 0
-  branch_data_ *get_branch_data(uint64_t branch_pos) {
-    uint64_t visit = sample_branch_pos_visit[branch_pos];
-    return pos_to_branch_data[branch_pos][visit].get(true);
-  }
-#else
-  branch_data_ *get_branch_data(uint64_t branch_pos) {
-    if (pos_to_branch_data.size() < branch_pos + 1)
-      pos_to_branch_data.resize(branch_pos + 1, {});
-
+  __attribute__((always_inline)) branch_data_ *get_branch_data(uint64_t branch_pos, uint64_t capacity, uint64_t offset) {
     uint64_t visit = sample_branch_pos_visit[branch_pos];
+    if (visit < capacity) [[likely]]
+      return branch_data_storage[offset + visit].get(true);
 
-    if (pos_to_branch_data[branch_pos].size() < visit + 1)
-      pos_to_branch_data[branch_pos].resize(visit + 1, {});
-
-    return pos_to_branch_data[branch_pos][visit].get(true);
+    return overflow_branch_data[visit * (_discograd_max_branch_pos + 1) + branch_pos].get(true);
   }
-#endif
 
   uint64_t compute_merged_gid(uint64_t set_at, uint64_t branch_pos) {
     return xorshift64star(set_at ^ ((branch_pos + 2) << 32) ^ (sample_branch_pos_visit[branch_pos] + 2));
   }
 
+  /** Prepare the branch at a position known at compile time, so that the
+   *  location of its storage is a constant. */
+  template<uint64_t branch_pos>
+  void prepare_branch(adouble& cond) {
+    static_assert(branch_pos <= _discograd_max_branch_pos);
+    prepare_branch(branch_pos, cond, branch_capacity[branch_pos], branch_offset[branch_pos]);
+  }
+
   void prepare_branch(uint64_t branch_pos, adouble& cond) {
+    prepare_branch(branch_pos, cond, branch_capacity[branch_pos], branch_offset[branch_pos]);
+  }
+
+  __attribute__((always_inline)) void prepare_branch(uint64_t branch_pos, adouble& cond, uint64_t capacity, uint64_t offset) {
     if (dgo_fork_limit > 0)
       branch_level++;
 
@@ -294,7 +369,7 @@ public:
     }
 
 #if DGO_FORK_LIMIT == 0
-    branch_data_ *bd = get_branch_data(branch_pos);
+    branch_data_ *bd = get_branch_data(branch_pos, capacity, offset);
 #else
     branch_data_ *bd;
     bd = &gid_to_branch_data[compute_merged_gid(cond.set_at.first, branch_pos)];
@@ -318,12 +393,21 @@ public:
       bd->carriers_false.add_candidate(cond, sample_id);
     }
 
+#ifdef RV_AD
+    if (!bd->carriers_pending) {
+      bd->carriers_pending = true;
+      pending_carrier_branches.push_back(bd);
+    }
+#endif
+
   }
 
-  void sample(DiscoGradProgram<num_inputs> &program) {
+  void sample(DiscoGradProgram<num_inputs> &program, uint64_t rep) {
 
 #if DGO_MIN_EXT_PERT == true
-    cond_signs = (BoolVector *)calloc(this->num_samples, sizeof(BoolVector));
+    cond_signs.resize(this->num_samples);
+    for (auto &cs : cond_signs)
+      cs.clear();
 #endif
 
     for (sample_id = 0; sample_id < this->num_samples; sample_id++) {
@@ -336,44 +420,73 @@ public:
         cond_signs[sample_id].resize(cond_signs[0].bool_size());
 #endif
 
-      array<adouble, num_inputs> pm_perturbed = this->parameters;
-      tangent_array perturbation = {};
-      for (int dim = 0; dim < num_inputs; dim++) {
-        if (this->perturbation_dim == -1 || this->perturbation_dim == dim)
-          perturbation[dim] = this->normal_dist(this->sampling_rng);
+      adouble::tape_rewind();
 
+      aparams pm_perturbed = this->parameters;
+      tangent_array perturbation = make_input_array<double, num_inputs>(this->num_dims);
+      this->draw_perturbation(perturbation, rep, sample_id, this->stddev);
+      for (int dim = 0; dim < this->num_dims; dim++)
         pm_perturbed[dim] += perturbation[dim];
-      }
-
-      if (this->rs_mode)
-        this->current_seed = this->seed_dist(this->rep_seed_gen);
 
-      this->rng.seed(this->current_seed);
+      this->seed_rng(rep, sample_id);
 
       adouble r = program.run(pm_perturbed);
 
+      // visit v of a position uses entry v of its storage
+      for (int pos = 0; pos <= _discograd_max_branch_pos; pos++)
+        branch_storage_used[pos] = max(branch_storage_used[pos], min(sample_branch_pos_visit[pos] + 1, branch_capacity[pos]));
+
+      if (!branch_profile.empty())
+        for (int pos = 0; pos <= _discograd_max_branch_pos; pos++)
+          branch_profile[pos] = max(branch_profile[pos], sample_branch_pos_visit[pos]);
+
       ys.push_back(r.val);
 
-      tangent_array dydx;
-      for (int dim = 0; dim < num_inputs; dim++)
+#ifdef RV_AD
+      // the tangents of the output and of the carriers that are still retained are
+      // computed by a single reverse sweep when first reading one of them
+      for (auto bd : pending_carrier_branches) {
+        bd->carriers_true.freeze(sample_id);
+        bd->carriers_false.freeze(sample_id);
+        bd->carriers_pending = false;
+      }
+      pending_carrier_branches.clear();
+      r.freeze();
+#endif
+
+      tangent_array dydx = make_input_array<double, num_inputs>(this->num_tangs);
+      for (int dim = 0; dim < this->num_tangs; dim++)
         dydx[dim] = r.get_tang(dim);
 
       dydxs.push_back(dydx);
+
+#ifdef RV_AD
+      r.release();
+#endif
     }
   }
 
   void flatten_branch_data() {
 #if DGO_FORK_LIMIT == 0
+    // the visits beyond the capacity follow the preallocated ones of the same position
+    vector<pair<pair<uint64_t, uint64_t>, branch_data_ *>> overflow; // (position, visit)
+    for (auto &item : overflow_branch_data)
+      overflow.push_back({{item.first % (_discograd_max_branch_pos + 1), item.first / (_discograd_max_branch_pos + 1)}, item.second.get()});
+    sort(overflow.begin(), overflow.end(), [](auto &a, auto &b) { return a.first < b.first; });
+
     int flat_branch_id = 0;
-    for (uint64_t pi = 0; pi < _discograd_max_branch_pos + 1; pi++) {
-      for (uint64_t bdi = 0; bdi < DGO_PREALLOC_BRANCH_DATA; bdi++) {
-        auto &item = pos_to_branch_data[pi][bdi];
-        branch_data_ *bd = item.get();
-        if (bd != nullptr && bd->has_carriers()) {
-          flat_branch_data.push_back({flat_branch_id, bd});
-          flat_branch_id++;
-        }
+    auto add = [&](branch_data_ *bd) {
+      if (bd != nullptr && bd->has_carriers()) {
+        flat_branch_data.push_back({flat_branch_id, bd});
+        flat_branch_id++;
       }
+    };
+    auto oit = overflow.begin();
+    for (uint64_t pi = 0; pi < _discograd_max_branch_pos + 1; pi++) {
+      for (uint64_t bdi = branch_offset[pi]; bdi < branch_offset[pi] + branch_storage_used[pi]; bdi++)
+        add(branch_data_storage[bdi].get());
+      for (; oit != overflow.end() && oit->first.first == pi; oit++)
+        add(oit->second);
     }
 #else
     flat_branch_data.reserve(gid_to_branch_data.size());
@@ -387,6 +500,9 @@ public:
   void compute_branch_tangents() {
     printf("total number of branches: %ld\n", flat_branch_data.size());
 
+    // the tangents of all mean conditions are obtained at once after freezing them
+    vector<branch_data_ *> weighted;
+
     for (auto &item : flat_branch_data) {
       auto &bd = *item.second;
 
@@ -404,10 +520,14 @@ public:
       for (size_t i = 0; i < min(bd.carriers_true.size, bd.carriers_false.size); i++) {
         bd.mean_cond += (bd.carriers_true[i].cond + bd.carriers_false[i].cond) / num_carriers;
       }
+      bd.mean_cond.freeze();
+      weighted.push_back(&bd);
+    }
 
-      bd.weight_tangent = shared_ptr<tangent_array>(new tangent_array);
-      for (int dim = 0; dim < num_inputs; dim++) {
-        (*bd.weight_tangent)[dim] = kde_at_zero * bd.mean_cond.get_tang(dim);
+    for (auto bd : weighted) {
+      bd->weight_tangent = make_shared<tangent_array>(make_input_array<double, num_inputs>(this->num_tangs));
+      for (int dim = 0; dim < this->num_tangs; dim++) {
+        (*bd->weight_tangent)[dim] = bd->kde_at_zero * bd->mean_cond.get_tang(dim);
       }
     }
   }
@@ -467,7 +587,6 @@ public:
           if (true_sample_id == false_sample_id)
             continue;
 
-          assert(cond_signs[true_sample_id].bool_size() == cond_signs[false_sample_id].bool_size());
           size_t key;
           if (true_sample_id < false_sample_id)
             key = ids_to_key(true_sample_id, false_sample_id);
@@ -518,7 +637,7 @@ public:
     }
     printf("did %lu full path comparisons\n", num_full_cmp);
 
-    for (int dim = 0; dim < num_inputs; dim++) {
+    for (int dim = 0; dim < this->num_tangs; dim++) {
       vector<branch_priority> branch_priorities;
 
       for (auto &item : flat_branch_data) {
@@ -580,44 +699,65 @@ public:
     }
   }
 
+  /** Write the maximum number of visits per sample of each branch position so far, as
+   *  input to the transformation's --branch-profile option. */
+  void write_branch_profile() {
+    FILE *f = fopen(this->branch_profile_fname.c_str(), "w");
+    if (f == nullptr) {
+      printf("cannot write branch profile to %s\n", this->branch_profile_fname.c_str());
+      return;
+    }
+    for (int pos = 0; pos <= _discograd_max_branch_pos; pos++)
+      fprintf(f, "%d %lu\n", pos, branch_profile[pos]);
+    fclose(f);
+  }
+
   void estimate_(DiscoGradProgram<num_inputs> &program) {
-    this->sampling_rng.seed(random_device()());
+    // the branch data of previous estimations is reset, keeping its memory
+    clean_up();
+    if (branch_data_storage == nullptr)
+      branch_data_storage = (branch_data_wrapper *)calloc(branch_offset[_discograd_max_branch_pos + 1], sizeof(branch_data_wrapper));
+    // only the entries touched by the previous estimation hold branch data
+    for (int pos = 0; pos <= _discograd_max_branch_pos; pos++) {
+      for (uint64_t bdi = branch_offset[pos]; bdi < branch_offset[pos] + branch_storage_used[pos]; bdi++)
+        branch_data_storage[bdi].reset();
+      branch_storage_used[pos] = 0;
+    }
+    for (auto &item : overflow_branch_data)
+      item.second.reset();
 
-    pos_to_branch_data = (branch_data_wrapper **)calloc(_discograd_max_branch_pos + 1, sizeof(branch_data_wrapper *));
-    for (int i = 0; i < _discograd_max_branch_pos + 1; i++)
-      pos_to_branch_data[i] = (branch_data_wrapper *)calloc(DGO_PREALLOC_BRANCH_DATA, sizeof(branch_data_wrapper));
+    if (!this->branch_profile_fname.empty() && branch_profile.empty())
+      branch_profile.resize(_discograd_max_branch_pos + 1, 0);
 
     double exp = 0.0;
-    double der[num_inputs] = {};
+    tangent_array der = make_input_array<double, num_inputs>(this->num_tangs);
     for (uint64_t rep = 0; rep < this->num_replications; ++rep) {
 
-      // determine seed for this replication
-      if (!this->rs_mode)
-        this->current_seed = this->seed_dist(this->rep_seed_gen); 
-
       // sample program and collect branch data
-      sample(program);
+      sample(program, rep);
 
       flatten_branch_data();
       compute_branch_tangents();
 
       // accumulate value and gradient
-      adouble mean_dydxs = 0;
       for (uint64_t sample_id = 0; sample_id < this->num_samples; sample_id++) {
-        for (int dim = 0; dim < num_inputs; dim++) {
+        for (int dim = 0; dim < this->num_tangs; dim++) {
           der[dim] += dydxs[sample_id][dim] / this->num_samples / this->num_replications;
         }
         exp += ys[sample_id];
       }
 
-      add_branch_tangents(der);
+      add_branch_tangents(der.data());
 
       if (this->num_replications > 1)
         clean_up();
     }
     this->exp_val = (exp / this->num_samples) / this->num_replications;
 
-    for (int dim = 0; dim < num_inputs; dim++)
+    if (!branch_profile.empty())
+      write_branch_profile();
+
+    for (int dim = 0; dim < this->num_tangs; dim++)
       this->exp_val.set_tang(dim, der[dim]);
   }
 };
@@ -31,6 +31,7 @@
 #include <stdexcept>
 #include <string>
 #include <vector>
+#include "multiversion.hpp"
 
 /// @file kde.h
 /// @brief Kernel Density Estimation for C++
@@ -83,6 +84,37 @@ constexpr T pi()
     return std::atan(1.0) * 4.0;
 }
 
+/// @brief Half-precision type for compactly stored data points.
+#ifdef __clang__
+typedef __fp16 half;
+#else
+typedef _Float16 half;
+#endif
+
+/// @brief Sum of the Gaussian kernel factor * exp(-1/2 * (point - x)^2 / h) over the data points x.
+template <typename T_IN, typename T>
+T gauss_sum(const T_IN *data, size_t n, T point, T factor, T h_inv)
+{
+    T sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        T diff = point - (T)data[i];
+        sum += (T)(factor * std::exp((-1.0/2.0) * diff * h_inv * diff));
+    }
+    return sum;
+}
+
+/// @brief gauss_sum() for half-precision data points, whose conversion uses F16C where available.
+MULTIVERSION_KERNEL(float, gauss_sum, (const half *data, size_t n, float point, float factor, float h_inv),
+                    (data, n, point, factor, h_inv))
+{
+    float sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        float diff = point - (float)data[i];
+        sum += (float)(factor * std::exp((-1.0/2.0) * diff * h_inv * diff));
+    }
+    return sum;
+}
+
 }  // namespace kdemath
 
 /// @brief Kernel density estimation for one dimensional data.
@@ -112,10 +144,7 @@ class Kde1d {
         if (invalid_arg)
           return 0.0;
 
-        T sum = 0;
-        for (auto const & i : data_) {
-            sum += kernel(point - (T)i);
-        }
+        T sum = kdemath::gauss_sum(data_.data(), data_.size(), point, pow_pi_term_ * h_pow_term_, h_pow_exp_term_);
         T n = data_.size();
         return sum / n;
     };
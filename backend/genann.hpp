@@ -45,11 +45,21 @@ public:
   static adouble act(adouble &a) { return (adouble)1.0 / (exp(-a) + 1); }
   static adouble act_output(adouble a) { return (adouble)1.0 / (exp(-a) + 1); }
 
-  genann(array<adouble, num_inputs> &p, int offset = 0) {
+  genann(input_array<adouble, num_inputs> &p, int offset = 0) {
     for (int i = 0; i < total_weights; i++)
       weight[i] = p[i + offset];
   }
 
+  /** Weighted sums minus bias of a layer of m neurons with n inputs each. Each
+   *  neuron's row in w holds the bias followed by the n weights. Advances w
+   *  past the layer. */
+  static void weighted_sums(adouble *&w, adouble *in, int n, int m, adouble *o) {
+    for (int j = 0; j < m; j++)
+      o[j] = w[j * (n + 1)] * -1.0;
+    agemv(m, n, w + 1, n + 1, in, 1.0, o);
+    w += m * (n + 1);
+  }
+
   adouble *run(adouble *in) {
     adouble *w = weight;
     adouble *o = output + inputs;
@@ -58,52 +68,36 @@ public:
     for (int i = 0; i < inputs; i++)
       output[i] = in[i];
 
-    int h, j, k;
+    int h, j;
 
     if (!hidden_layers) {
       adouble *ret = o;
-      for (j = 0; j < outputs; ++j) {
-        adouble sum = *w++ * -1.0;
-        for (k = 0; k < inputs; ++k) {
-          sum += *w++ * i[k];
-        }
-        *o++ = act_output(sum);
-      }
+      weighted_sums(w, i, inputs, outputs, o);
+      for (j = 0; j < outputs; ++j, ++o)
+        *o = act_output(*o);
 
       return ret;
     }
 
-    for (j = 0; j < hidden; ++j) {
-      adouble sum = *w++ * -1.0;
-      for (k = 0; k < inputs; ++k) {
-        sum += *w++ * i[k];
-      }
-      *o++ = act(sum);
-    }
+    weighted_sums(w, i, inputs, hidden, o);
+    for (j = 0; j < hidden; ++j, ++o)
+      *o = act(*o);
 
     i += inputs;
 
     for (h = 1; h < hidden_layers; ++h) {
-      for (j = 0; j < hidden; ++j) {
-        adouble sum = *w++ * -1.0;
-        for (k = 0; k < hidden; ++k) {
-          sum += *w++ * i[k];
-        }
-        *o++ = act(sum);
-      }
+      weighted_sums(w, i, hidden, hidden, o);
+      for (j = 0; j < hidden; ++j, ++o)
+        *o = act(*o);
 
       i += hidden;
     }
 
     adouble *ret = o;
 
-    for (j = 0; j < outputs; ++j) {
-      adouble sum = *w++ * -1.0;
-      for (k = 0; k < hidden; ++k) {
-        sum += *w++ * i[k];
-      }
-      *o++ = act_output(sum);
-    }
+    weighted_sums(w, i, hidden, outputs, o);
+    for (j = 0; j < outputs; ++j, ++o)
+      *o = act_output(*o);
 
     assert(w - weight == total_weights);
     assert(o - output == total_neurons);
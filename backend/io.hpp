@@ -0,0 +1,209 @@
+/* Copyright 2023, 2024 Philipp Andelfinger, Justin Kreikemeyer
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the “Software”), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE. */
+
+/** Input of the parameter combinations and output of the results as text or
+ * in binary, selected via --in-format and --out-format. The binary formats
+ * start with a BinaryHeader, followed by the combinations, each holding
+ * num_values doubles and num_direction_values doubles: the parameters and
+ * the directions in --read-directions mode, or the derivatives and the
+ * directions drawn in --directions mode. Each result starts with the
+ * expectation as a double and the estimation duration in microseconds as a
+ * uint64. All values are little-endian. Binary input files given via
+ * --in-file are memory-mapped. The results can also be written as one JSON
+ * object per line, keeping the full precision of doubles. In both formats,
+ * the results keep stdout to themselves.
+ */
+
+#pragma once
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct BinaryHeader {
+  char magic[4];                 /**< DGIN for parameters, DGRE for results */
+  uint32_t num_values;           /**< Parameters or derivatives per combination */
+  uint32_t num_direction_values; /**< Per combination, following the parameters or derivatives */
+  uint32_t padding = 0;
+  uint64_t num_combinations;
+};
+
+static_assert(sizeof(BinaryHeader) == 24, "the binary header must not contain padding");
+
+/** Convert n little-endian values of 4 or 8 bytes to the host's byte order or vice versa. */
+template <typename T> void convert_little_endian(T *values, size_t n) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  static_assert(sizeof(T) == 4 || sizeof(T) == 8, "only 32- and 64-bit values are converted");
+  for (size_t i = 0; i < n; i++) {
+    if constexpr (sizeof(T) == 4) {
+      uint32_t u;
+      memcpy(&u, &values[i], 4);
+      u = __builtin_bswap32(u);
+      memcpy(&values[i], &u, 4);
+    } else {
+      uint64_t u;
+      memcpy(&u, &values[i], 8);
+      u = __builtin_bswap64(u);
+      memcpy(&values[i], &u, 8);
+    }
+  }
+#endif
+}
+
+inline void convert_little_endian(BinaryHeader &header) {
+  convert_little_endian(&header.num_values, 1);
+  convert_little_endian(&header.num_direction_values, 1);
+  convert_little_endian(&header.num_combinations, 1);
+}
+
+/** Source of the parameter combinations: text or binary from stdin or a file. */
+class ParamInput {
+public:
+  ParamInput(bool binary, const std::string &fname) : binary(binary) {
+    if (fname.empty()) {
+      f = stdin;
+    } else if (binary) {
+      int fd = open(fname.c_str(), O_RDONLY);
+      struct stat st;
+      if (fd < 0 || fstat(fd, &st) != 0) {
+        printf("cannot open %s, exiting\n", fname.c_str());
+        exit(1);
+      }
+      map_size = st.st_size;
+      if (map_size > 0) {
+        map = (const char *)mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+          printf("cannot map %s, exiting\n", fname.c_str());
+          exit(1);
+        }
+        madvise((void *)map, map_size, MADV_SEQUENTIAL);
+      }
+      close(fd);
+    } else if ((f = fopen(fname.c_str(), "r")) == nullptr) {
+      printf("cannot open %s, exiting\n", fname.c_str());
+      exit(1);
+    }
+
+    if (binary && (!read_raw(&header, sizeof(header)) || memcmp(header.magic, "DGIN", 4) != 0)) {
+      printf("binary input does not start with a header, exiting\n");
+      exit(1);
+    }
+    convert_little_endian(header);
+  }
+
+  ~ParamInput() {
+    if (map != nullptr)
+      munmap((void *)map, map_size);
+    else if (f != stdin)
+      fclose(f);
+  }
+
+  /** Read n values, false if the input ended before. */
+  bool read(double *values, size_t n) {
+    if (binary) {
+      if (!read_raw(values, n * sizeof(double)))
+        return false;
+      convert_little_endian(values, n);
+      return true;
+    }
+    for (size_t i = 0; i < n; i++)
+      if (fscanf(f, "%lf", &values[i]) != 1)
+        return false;
+    return true;
+  }
+
+  bool is_binary() const { return binary; }
+
+  BinaryHeader header = {}; /**< Of binary input. */
+
+private:
+  bool binary;
+  FILE *f = nullptr;
+  const char *map = nullptr; /**< Binary input file, read up to map_pos. */
+  size_t map_size = 0, map_pos = 0;
+
+  bool read_raw(void *dest, size_t n) {
+    if (map == nullptr)
+      return fread(dest, 1, n, f) == n;
+    if (map_size - map_pos < n)
+      return false;
+    memcpy(dest, map + map_pos, n);
+    map_pos += n;
+    return true;
+  }
+};
+
+/** The stream the results are written to, decided on the first call. For the machine-readable formats,
+ *  the results are written to the original stdout, and other output is redirected to stderr. */
+inline FILE *results_stream(bool machine_readable = false) {
+  static FILE *out = [&] {
+    if (!machine_readable)
+      return stdout;
+    fflush(stdout);
+    FILE *r = fdopen(dup(STDOUT_FILENO), "w");
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    return r;
+  }();
+  return out;
+}
+
+/** Write the header of binary results. */
+inline void write_binary_header(FILE *out, uint32_t num_derivatives, uint32_t num_direction_values, uint64_t num_combinations) {
+  BinaryHeader header = {{'D', 'G', 'R', 'E'}, num_derivatives, num_direction_values, 0, num_combinations};
+  convert_little_endian(header);
+  fwrite(&header, sizeof(header), 1, out);
+}
+
+/** Write n values in binary. */
+template <typename T> void write_binary(FILE *out, const T *values, size_t n) {
+  T buf[256];
+  for (size_t i = 0; i < n; i += 256) {
+    size_t m = n - i < 256 ? n - i : 256;
+    memcpy(buf, values + i, m * sizeof(T));
+    convert_little_endian(buf, m);
+    fwrite(buf, sizeof(T), m, out);
+  }
+}
+
+/** Write x as a JSON number, or null if it is not finite. */
+inline void write_json(FILE *out, double x) {
+  if (isfinite(x))
+    fprintf(out, "%.17g", x);
+  else
+    fputs("null", out);
+}
+
+/** Write a JSON array of n values. */
+inline void write_json(FILE *out, const double *values, size_t n) {
+  fputc('[', out);
+  for (size_t i = 0; i < n; i++) {
+    if (i > 0)
+      fputc(',', out);
+    write_json(out, values[i]);
+  }
+  fputc(']', out);
+}
@@ -0,0 +1,98 @@
+/* Copyright 2023, 2024 Philipp Andelfinger, Justin Kreikemeyer
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the “Software”), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE. */
+
+/** Function multiversioning for the hot kernels, enabled by -DPORTABLE.
+ * smooth_compile then builds for the x86-64 baseline instead of the host CPU,
+ * and each kernel defined by MULTIVERSION_KERNEL is additionally compiled for
+ * the x86-64-v2 (SSE4.2), x86-64-v3 (AVX2, FMA, F16C) and x86-64-v4 (AVX-512)
+ * feature levels. On the first call, the variant for the best level supported
+ * by the CPU is selected via CPUID and called through a function pointer.
+ *
+ * The dispatch is explicit rather than via target_clones, since clang does not
+ * support multiversioned templates and the feature sets of the levels cannot be
+ * named uniformly in target_clones across compilers.
+ *
+ * Without PORTABLE, a kernel is an ordinary inline function.
+ *
+ * Usage: MULTIVERSION_KERNEL(ret, name, (params), (args)) { body }
+ */
+
+#pragma once
+
+#define MULTIVERSION_ALWAYS_INLINE __attribute__((always_inline)) inline
+
+#if defined PORTABLE && defined __x86_64__
+
+#define MULTIVERSION_TARGET_V2 "sse4.2,popcnt"
+#define MULTIVERSION_TARGET_V3 "sse4.2,popcnt,avx,avx2,fma,f16c,bmi,bmi2,lzcnt"
+#define MULTIVERSION_TARGET_V4 MULTIVERSION_TARGET_V3 ",avx512f,avx512vl,avx512bw,avx512dq,avx512cd"
+
+namespace multiversion {
+
+enum level { baseline, v2, v3, v4 };
+
+inline level cpu_level() {
+  __builtin_cpu_init();
+  if (!__builtin_cpu_supports("sse4.2") || !__builtin_cpu_supports("popcnt"))
+    return baseline;
+  if (!__builtin_cpu_supports("avx2") || !__builtin_cpu_supports("fma") || !__builtin_cpu_supports("f16c") ||
+      !__builtin_cpu_supports("bmi") || !__builtin_cpu_supports("bmi2"))
+    return v2;
+  if (!__builtin_cpu_supports("avx512f") || !__builtin_cpu_supports("avx512vl") || !__builtin_cpu_supports("avx512bw") ||
+      !__builtin_cpu_supports("avx512dq") || !__builtin_cpu_supports("avx512cd"))
+    return v3;
+  return v4;
+}
+
+/** The level of the CPU we are running on, determined once. */
+inline level selected_level() {
+  static const level l = cpu_level();
+  return l;
+}
+
+} // namespace multiversion
+
+#define MULTIVERSION_KERNEL(RET, NAME, PARAMS, ARGS)                           \
+  MULTIVERSION_ALWAYS_INLINE RET NAME##_body PARAMS;                           \
+  __attribute__((target(MULTIVERSION_TARGET_V2))) inline RET NAME##_v2 PARAMS { return NAME##_body ARGS; } \
+  __attribute__((target(MULTIVERSION_TARGET_V3))) inline RET NAME##_v3 PARAMS { return NAME##_body ARGS; } \
+  __attribute__((target(MULTIVERSION_TARGET_V4))) inline RET NAME##_v4 PARAMS { return NAME##_body ARGS; } \
+  inline RET NAME##_baseline PARAMS { return NAME##_body ARGS; }               \
+  inline RET NAME PARAMS {                                                     \
+    static RET(*const impl) PARAMS = [] {                                      \
+      switch (multiversion::selected_level()) {                                \
+      case multiversion::v4: return &NAME##_v4;                                \
+      case multiversion::v3: return &NAME##_v3;                                \
+      case multiversion::v2: return &NAME##_v2;                                \
+      default: return &NAME##_baseline;                                        \
+      }                                                                        \
+    }();                                                                       \
+    return impl ARGS;                                                          \
+  }                                                                            \
+  MULTIVERSION_ALWAYS_INLINE RET NAME##_body PARAMS
+
+#else
+
+#define MULTIVERSION_KERNEL(RET, NAME, PARAMS, ARGS)                           \
+  MULTIVERSION_ALWAYS_INLINE RET NAME##_body PARAMS;                           \
+  MULTIVERSION_ALWAYS_INLINE RET NAME PARAMS { return NAME##_body ARGS; }      \
+  MULTIVERSION_ALWAYS_INLINE RET NAME##_body PARAMS
+
+#endif
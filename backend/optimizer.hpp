@@ -0,0 +1,126 @@
+/* Copyright 2023, 2024 Philipp Andelfinger, Justin Kreikemeyer
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the “Software”), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE. */
+
+/** Update rules for the in-process optimization via --optimize: (stochastic)
+ * gradient descent and Adam, each with an optional projection onto bounds on
+ * the inputs, and step sizes that are constant or decay with the iteration.
+ * The optimizer state is kept across the steps, the estimation loop is
+ * DiscoGradBase::optimize().
+ */
+
+#pragma once
+
+#include <limits>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+/** Settings of an optimization. */
+struct OptimizerOptions {
+  std::string method;             /**< sgd or adam, empty: no optimization. */
+  uint64_t iterations = 100;
+  double lr = 0.01;               /**< Initial step size. */
+  std::string schedule = "constant"; /**< constant, inverse: lr / (1 + decay * t), exponential: lr * exp(-decay * t). */
+  double lr_decay = 0.0;
+  double lower = -std::numeric_limits<double>::infinity(); /**< Bounds on each input, projected onto after each step. */
+  double upper = std::numeric_limits<double>::infinity();
+  double beta1 = 0.9, beta2 = 0.999, epsilon = 1e-8; /**< Adam */
+  std::string checkpoint_fname;   /**< Where the iterates are appended, empty: no checkpoints. */
+  uint64_t checkpoint_interval = 10;
+};
+
+class Optimizer {
+public:
+  Optimizer(const OptimizerOptions &opts, int num_dims) : opts(opts) {
+    if (opts.method != "sgd" && opts.method != "adam") {
+      printf("unknown optimizer %s, expected sgd or adam, exiting\n", opts.method.c_str());
+      exit(1);
+    }
+    if (opts.schedule != "constant" && opts.schedule != "inverse" && opts.schedule != "exponential") {
+      printf("unknown step size schedule %s, expected constant, inverse or exponential, exiting\n", opts.schedule.c_str());
+      exit(1);
+    }
+    if (opts.checkpoint_interval == 0) {
+      printf("checkpoint interval must be positive, exiting\n");
+      exit(1);
+    }
+    if (opts.method == "adam") {
+      m.assign(num_dims, 0.0);
+      v.assign(num_dims, 0.0);
+    }
+  }
+
+  /** Step size of iteration t, counting from 0. */
+  double step_size(uint64_t t) const {
+    if (opts.schedule == "inverse")
+      return opts.lr / (1.0 + opts.lr_decay * t);
+    if (opts.schedule == "exponential")
+      return opts.lr * exp(-opts.lr_decay * t);
+    return opts.lr;
+  }
+
+  /** Move x of n inputs against the gradient g, then project x onto the bounds. */
+  template <typename X, typename G> void step(X &x, const G &g, int n) {
+    double lr = step_size(t);
+    t++;
+    if (opts.method == "sgd") {
+      for (int i = 0; i < n; i++)
+        x[i] -= lr * g[i];
+    } else {
+      double c1 = 1.0 - pow(opts.beta1, t), c2 = 1.0 - pow(opts.beta2, t);
+      for (int i = 0; i < n; i++) {
+        m[i] = opts.beta1 * m[i] + (1.0 - opts.beta1) * g[i];
+        v[i] = opts.beta2 * v[i] + (1.0 - opts.beta2) * g[i] * g[i];
+        x[i] -= lr * (m[i] / c1) / (sqrt(v[i] / c2) + opts.epsilon);
+      }
+    }
+    for (int i = 0; i < n; i++)
+      x[i] = fmin(fmax(x[i], opts.lower), opts.upper);
+  }
+
+  /** Append the iteration, the expectation at x and x to the checkpoint file every
+   *  checkpoint_interval iterations and at the last one. The file is truncated at the first write. */
+  template <typename X> void checkpoint(uint64_t iteration, double expectation, const X &x, int n) {
+    if (opts.checkpoint_fname.empty())
+      return;
+    if ((iteration + 1) % opts.checkpoint_interval != 0 && iteration + 1 != opts.iterations)
+      return;
+
+    FILE *f = fopen(opts.checkpoint_fname.c_str(), written ? "a" : "w");
+    if (f == nullptr) {
+      printf("cannot write checkpoint to %s\n", opts.checkpoint_fname.c_str());
+      return;
+    }
+    fprintf(f, "%lu %.10g", iteration, expectation);
+    for (int i = 0; i < n; i++)
+      fprintf(f, " %.10g", (double)x[i]);
+    fprintf(f, "\n");
+    fclose(f);
+    written = true;
+  }
+
+private:
+  OptimizerOptions opts;
+  uint64_t t = 0;           /**< Number of steps taken. */
+  std::vector<double> m, v; /**< Adam moment estimates */
+  bool written = false;
+};
@@ -0,0 +1,145 @@
+/* Copyright 2023, 2024 Philipp Andelfinger, Justin Kreikemeyer
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the “Software”), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE. */
+
+/** Counter-based random number generator Philox4x32-10 (Salmon et al.,
+ * Parallel Random Numbers: As Easy as 1, 2, 3, SC 2011). Each value is a
+ * function of its address and position, so that the random numbers of any
+ * sample can be regenerated independently of the others. An address consists
+ * of a seed and a stream (the key), and of a replication and a sample (the
+ * upper words of the counter). Each address yields 2^34 values.
+ *
+ * Satisfies the requirements of a uniform random bit generator, so that the
+ * distributions of the standard library can draw from it.
+ */
+
+#pragma once
+
+#include <array>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+class Philox4x32 {
+public:
+  typedef uint32_t result_type;
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() { return UINT32_MAX; }
+
+  Philox4x32(uint32_t seed = 0, uint32_t replication = 0, uint64_t sample = 0, uint32_t stream = 0) {
+    this->seed(seed, replication, sample, stream);
+  }
+
+  /** Start at the first value of the given address. */
+  void seed(uint32_t seed, uint32_t replication = 0, uint64_t sample = 0, uint32_t stream = 0) {
+    key = {seed, stream};
+    address = {replication, (uint32_t)sample, (uint32_t)(sample >> 32)};
+    index = 0;
+    buffered_block = UINT64_MAX;
+  }
+
+  result_type operator()() {
+    uint64_t b = index >> 2;
+    if (b != buffered_block) {
+      buffer = block(b);
+      buffered_block = b;
+    }
+    return buffer[index++ & 3];
+  }
+
+  /** Skip n values in constant time. */
+  void discard(uint64_t n) { index += n; }
+
+  /** Write the next n values to out, whole blocks directly. */
+  void generate(result_type *out, size_t n) {
+    size_t i = 0;
+    for (; i < n && (index & 3) != 0; i++)
+      out[i] = (*this)();
+    for (; n - i >= 4; i += 4, index += 4) {
+      std::array<uint32_t, 4> r = block(index >> 2);
+      memcpy(out + i, r.data(), sizeof(r));
+    }
+    for (; i < n; i++)
+      out[i] = (*this)();
+  }
+
+  /** Uniform value in [0, 1) with 53 random bits. */
+  double uniform() {
+    uint32_t a = (*this)() >> 5, b = (*this)() >> 6;
+    return (a * 67108864.0 + b) * (1.0 / 9007199254740992.0);
+  }
+
+  /** Write n uniform values in [0, 1) to out. */
+  void fill_uniform(double *out, size_t n) {
+    uint32_t bits[2 * chunk];
+    for (size_t i = 0; i < n; i += chunk) {
+      size_t m = n - i < chunk ? n - i : chunk;
+      generate(bits, 2 * m);
+      for (size_t j = 0; j < m; j++)
+        out[i + j] = ((bits[2 * j] >> 5) * 67108864.0 + (bits[2 * j + 1] >> 6)) * (1.0 / 9007199254740992.0);
+    }
+  }
+
+  /** Standard normal value via the Box-Muller transform, taking two uniform values. */
+  double normal() {
+    double u1 = 1.0 - uniform(), u2 = uniform(); // u1 in (0, 1]
+    return sqrt(-2.0 * log(u1)) * cos(2 * M_PI * u2);
+  }
+
+  /** Write n standard normal values to out, two per pair of uniform values. */
+  void fill_normal(double *out, size_t n) {
+    double u[chunk];
+    for (size_t i = 0; i < n; i += chunk) {
+      size_t m = n - i < chunk ? n - i : chunk;
+      size_t num_pairs = (m + 1) / 2;
+      fill_uniform(u, 2 * num_pairs);
+      for (size_t p = 0; p < num_pairs; p++) {
+        double r = sqrt(-2.0 * log(1.0 - u[2 * p])), phi = 2 * M_PI * u[2 * p + 1];
+        out[i + 2 * p] = r * cos(phi);
+        if (2 * p + 1 < m)
+          out[i + 2 * p + 1] = r * sin(phi);
+      }
+    }
+  }
+
+  /** The block of four values at position b of the address. */
+  std::array<uint32_t, 4> block(uint64_t b) const {
+    std::array<uint32_t, 4> ctr = {(uint32_t)b, address[0], address[1], address[2]};
+    std::array<uint32_t, 2> k = key;
+    for (int round = 0; round < 10; round++) {
+      if (round > 0) {
+        k[0] += 0x9E3779B9;
+        k[1] += 0xBB67AE85;
+      }
+      uint64_t p0 = (uint64_t)0xD2511F53 * ctr[0], p1 = (uint64_t)0xCD9E8D57 * ctr[2];
+      ctr = {(uint32_t)(p1 >> 32) ^ ctr[1] ^ k[0], (uint32_t)p1, (uint32_t)(p0 >> 32) ^ ctr[3] ^ k[1], (uint32_t)p0};
+    }
+    return ctr;
+  }
+
+private:
+  static constexpr size_t chunk = 128;
+
+  std::array<uint32_t, 2> key;
+  std::array<uint32_t, 3> address;   /**< Replication and sample, the counter's upper words. */
+  uint64_t index;                    /**< Position of the next value. */
+  std::array<uint32_t, 4> buffer;
+  uint64_t buffered_block;
+};
@@ -24,13 +24,15 @@
 using namespace std;
 
 template<int num_inputs>
-class DiscoGrad : public DiscoGradBase<num_inputs> {
+class PolyakGradientOracle : public virtual DiscoGradBase<num_inputs> {
 
 private:
   double exp = 0.0;
-  double deriv[num_inputs] = { 0.0 };
+  input_array<double, num_inputs> deriv = make_input_array<double, num_inputs>(this->num_dims);
 
 public:
+  static constexpr const char *name = "pgo";
+
   /** Estimator according to a formulation of Nesterov and Spokoiny
    * - Basic scheme discussed in B. Polyak, Introduction to Optimization. Optimization Software - Inc., Publications Division, New York, 1987
    * - Convergence of optimization scheme analyzed in Nesterov and Spokoiny, Random Gradient-Free Minimization of Convex Functions. Found Comput Math 17, 527-566 
@@ -41,45 +43,36 @@ public:
    *
    *    The above is done for each replication and then averaged again over all replications.
    */
-  DiscoGrad(int argc, char **argv, bool debug=false) : DiscoGradBase<num_inputs>(argc, argv, debug) {};
+  PolyakGradientOracle(int argc, char **argv, bool debug=false) : DiscoGradBase<num_inputs>(argc, argv, debug) {};
 
   void estimate_(DiscoGradProgram<num_inputs> &program) {
     assert(this->stddev > 0);
+    exp = 0.0;
+    fill(deriv.begin(), deriv.end(), 0.0);
 
-    default_random_engine reference_seed_gen(this->seed + 1);
     for (uint64_t rep = 0; rep < this->num_replications; ++rep) {
 
       if (this->rs_mode) // single reference, one or more _unrelated_ reps (here: equal to samples)
-        this->current_seed = this->seed_dist(reference_seed_gen);
+        this->rng.seed(this->seed, rep, 0, this->reference_stream);
       else // single reference per rep, one or more samples with the _same_ rep seed
-        this->current_seed = this->seed_dist(this->rep_seed_gen);
-
-      this->rng.seed(this->current_seed);
+        this->seed_rng(rep, 0);
 
       double crisp_ref = program.run(this->parameters).get_val(); // f(x)
 
-      array<double, num_inputs> perturbation = {};
+      input_array<double, num_inputs> perturbation = make_input_array<double, num_inputs>(this->num_dims);
 
       for (uint64_t sample = 0; sample < this->num_samples; sample++) {
-
-        if (this->rs_mode)
-          this->current_seed = this->seed_dist(this->rep_seed_gen);
- 
-        normal_distribution<double> normal_dist(0, 1);
-        array<adouble, num_inputs> pm_perturbed = this->parameters;
-        for (int dim = 0; dim < num_inputs; ++dim)
-        {
-          if (this->perturbation_dim == -1 || this->perturbation_dim == dim)
-            perturbation[dim] = normal_dist(this->sampling_rng);
-
+        aparams pm_perturbed = this->parameters;
+        this->draw_perturbation(perturbation, rep, sample, 1.0);
+        for (int dim = 0; dim < this->num_dims; ++dim)
           pm_perturbed[dim] += perturbation[dim] * this->stddev;
-        }
+
         // execute program on perturbed parameters
-        this->rng.seed(this->current_seed);
+        this->seed_rng(rep, sample);
         double perturbed = program.run(pm_perturbed).get_val(); // f(x+u*stddev)
 
         exp += perturbed;
-        for (int dim = 0; dim < num_inputs; ++dim) {
+        for (int dim = 0; dim < this->num_dims; ++dim) {
           deriv[dim] += ((perturbed - crisp_ref) / this->stddev * perturbation[dim]) / this->num_samples; // 1/num_samples * sum( (f(x+u*stddev) - f(x)) / stddev * u )
         }
       }
@@ -87,10 +80,12 @@ public:
     
     // statistics over replications
     this->exp_val = (exp / this->num_samples) / this->num_replications;
-    for (int dim = 0; dim < num_inputs; ++dim) {
+    for (int dim = 0; dim < this->num_dims; ++dim) {
       deriv[dim] /= this->num_replications;
     }
   }
 
   double derivative(int dim) const { return deriv[dim]; }
+  double directional_derivative(int k) const { return this->project(deriv, k); }
+  bool differentiates() const { return false; }
 };
@@ -24,15 +24,17 @@
 using namespace std;
 
 template<int num_inputs>
-class DiscoGrad : public DiscoGradBase<num_inputs> {
+class Reinforce : public virtual DiscoGradBase<num_inputs> {
 
 private:
-  array<double, num_inputs> perturbations = {};
+  input_array<double, num_inputs> perturbations = make_input_array<double, num_inputs>(this->num_dims);
   double exp = 0.0;
-  double deriv[num_inputs] = { 0.0 };
+  input_array<double, num_inputs> deriv = make_input_array<double, num_inputs>(this->num_dims);
 
 public:
-  DiscoGrad(int argc, char **argv, bool debug=false) : DiscoGradBase<num_inputs>(argc, argv, debug) {};
+  static constexpr const char *name = "reinforce";
+
+  Reinforce(int argc, char **argv, bool debug=false) : DiscoGradBase<num_inputs>(argc, argv, debug) {};
 
   double deriv_log_norm_pdf(double x, double mu) { return (x - mu) / this->variance; }
 
@@ -41,31 +43,31 @@ public:
    * https://doi.org/10.1007/BF00992696
    */
   void estimate_(DiscoGradProgram<num_inputs> &program) {
+    exp = 0.0;
+    fill(deriv.begin(), deriv.end(), 0.0);
     for (uint64_t rep = 0; rep < this->num_replications; ++rep) {
-      this->current_seed = this->seed_dist(this->rep_seed_gen);
-      this->rng.seed(this->current_seed);
       for (uint64_t sample = 0; sample < this->num_samples; ++sample) {
-        array<adouble, num_inputs> pm_perturbed;
-        for (int dim = 0; dim < num_inputs; ++dim) {
-          if (this->perturbation_dim == -1 || this->perturbation_dim == dim)
-            perturbations[dim] = this->normal_dist(this->sampling_rng);
-
+        aparams pm_perturbed = make_input_array<adouble, num_inputs>(this->num_dims);
+        this->draw_perturbation(perturbations, rep, sample, this->stddev);
+        for (int dim = 0; dim < this->num_dims; ++dim)
           pm_perturbed[dim] = this->parameters[dim] + perturbations[dim];
-        }
-        // execute program on perturbed parameters
-        this->rng.seed(this->current_seed);
+
+        // execute program on perturbed parameters, all samples of a replication with the same random numbers
+        this->seed_rng(rep, 0);
         double perturbed = program.run(pm_perturbed).get_val(); // f(x+u*stddev)
         exp += perturbed;
-        for (int dim = 0; dim < num_inputs; ++dim)
+        for (int dim = 0; dim < this->num_dims; ++dim)
           deriv[dim] += perturbed * deriv_log_norm_pdf(pm_perturbed[dim].val, pm_perturbed[dim].val - perturbations[dim]) / this->num_samples;
       }
     }
     
     // statistics over replications
     this->exp_val = (exp / this->num_samples) / this->num_replications;
-    for (int dim = 0; dim < num_inputs; ++dim)
+    for (int dim = 0; dim < this->num_dims; ++dim)
       deriv[dim] /= this->num_replications;
   }
 
   double derivative(int dim) const { return deriv[dim]; }
+  double directional_derivative(int k) const { return this->project(deriv, k); }
+  bool differentiates() const { return false; }
 };
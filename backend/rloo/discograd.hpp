@@ -24,48 +24,38 @@
 using namespace std;
 
 template<int num_inputs>
-class DiscoGrad : public DiscoGradBase<num_inputs> {
+class Rloo : public virtual DiscoGradBase<num_inputs> {
 
 private:
-  vector<array<double, num_inputs>> perturbations;
+  vector<input_array<double, num_inputs>> perturbations;
   double expect = 0.0;
-  double deriv[num_inputs] = { 0.0 };
+  input_array<double, num_inputs> deriv = make_input_array<double, num_inputs>(this->num_dims);
 
 public:
-  DiscoGrad(int argc, char **argv, bool debug=false) : DiscoGradBase<num_inputs>(argc, argv, debug) {};
+  static constexpr const char *name = "rloo";
+
+  Rloo(int argc, char **argv, bool debug=false) : DiscoGradBase<num_inputs>(argc, argv, debug) {};
 
   double deriv_log_norm_pdf(double x, double mu) { return (x - mu) / this->variance; }
 
   void estimate_(DiscoGradProgram<num_inputs> &program) {
+    expect = 0.0;
+    fill(deriv.begin(), deriv.end(), 0.0);
+    perturbations.clear();
     vector<double> perturbed;
-    default_random_engine reference_seed_gen(this->seed + 1);
     for (uint64_t rep = 0; rep < this->num_replications; ++rep) {
-
-      if (this->rs_mode) // single reference, one or more _unrelated_ reps (here: equal to samples)
-        this->current_seed = this->seed_dist(reference_seed_gen);
-      else // single reference per rep, one or more samples with the _same_ rep seed
-        this->current_seed = this->seed_dist(this->rep_seed_gen);
-
-      this->rng.seed(this->current_seed);
-
       for (uint64_t sample = 0; sample < this->num_samples; ++sample) {
-        if (this->rs_mode)
-          this->current_seed = this->seed_dist(this->rep_seed_gen);
-
-        array<double, num_inputs> perturbation;
-
-        array<adouble, num_inputs> pm_perturbed;
-        for (int dim = 0; dim < num_inputs; ++dim) {
-          if (this->perturbation_dim == -1 || this->perturbation_dim == dim)
-            perturbation[dim] = this->normal_dist(this->sampling_rng);
+        input_array<double, num_inputs> perturbation = make_input_array<double, num_inputs>(this->num_dims);
+        this->draw_perturbation(perturbation, rep, sample, this->stddev);
 
+        aparams pm_perturbed = make_input_array<adouble, num_inputs>(this->num_dims);
+        for (int dim = 0; dim < this->num_dims; ++dim)
           pm_perturbed[dim] = this->parameters[dim] + perturbation[dim];
-        }
 
         perturbations.push_back(perturbation);
 
         // execute program on perturbed parameters
-        this->rng.seed(this->current_seed);
+        this->seed_rng(rep, sample);
         perturbed.push_back(program.run(pm_perturbed).get_val()); // f(x+u*stddev)
         expect += perturbed.back();
       }
@@ -75,16 +65,18 @@ public:
     this->exp_val = expect / total_runs;
 
     for (int s = 0; s < total_runs; s++) {
-      for (int dim = 0; dim < num_inputs; ++dim) {
+      for (int dim = 0; dim < this->num_dims; ++dim) {
         double fs = perturbed[s];
         double b = (expect - fs) / (total_runs - 1);
         deriv[dim] += (fs - b) * deriv_log_norm_pdf(perturbations[s][dim], 0);
       }
     }
 
-    for (int dim = 0; dim < num_inputs; ++dim)
+    for (int dim = 0; dim < this->num_dims; ++dim)
       deriv[dim] /= total_runs;
   }
 
   double derivative(int dim) const { return deriv[dim]; }
+  double directional_derivative(int k) const { return this->project(deriv, k); }
+  bool differentiates() const { return false; }
 };
@@ -0,0 +1,220 @@
+/* Copyright 2023, 2024 Philipp Andelfinger, Justin Kreikemeyer
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the “Software”), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE. */
+
+/** Socket handling and binary framing of the estimation server started via
+ * --serve. Clients connect to a Unix domain socket and send requests, each
+ * a ServerRequest followed by num_params parameters and num_direction_values
+ * direction values as doubles. Each request is answered by a ServerResponse
+ * followed by num_derivatives derivatives and num_direction_values direction
+ * values. All values are in the byte order of the server's host. A client may
+ * send further requests before receiving the responses, which arrive in the
+ * order of the requests. Requests of different clients are processed in turns.
+ * The decoding and estimation is DiscoGradBase::serve().
+ */
+
+#pragma once
+
+#include <errno.h>
+#include <functional>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+/** Fixed-size part of a request. */
+struct ServerRequest {
+  int32_t seed;                  /**< -1: random */
+  int32_t perturbation_dim;      /**< -1: all */
+  uint64_t num_samples;
+  uint64_t num_replications;
+  double variance;
+  uint32_t num_params;
+  uint32_t num_direction_values; /**< 0: directions drawn at random in --directions mode */
+};
+
+/** Fixed-size part of a response. */
+struct ServerResponse {
+  enum status_t : uint32_t { ok, malformed_request, wrong_num_params, wrong_num_direction_values, invalid_options };
+
+  uint32_t status;
+  uint32_t num_derivatives;
+  double expectation;
+  uint64_t estimate_duration_us;
+  uint32_t num_direction_values;
+  uint32_t padding = 0;
+};
+
+static_assert(sizeof(ServerRequest) == 40 && sizeof(ServerResponse) == 32, "requests and responses must not contain padding");
+
+class EstimationServer {
+public:
+  /** Answers a request, given the values following it, by appending the response to out. */
+  typedef std::function<void(const ServerRequest &req, const double *values, std::vector<char> &out)> handler_t;
+
+  EstimationServer(const std::string &path) {
+    if (path.size() >= sizeof(sockaddr_un::sun_path)) {
+      printf("socket path %s is too long, exiting\n", path.c_str());
+      exit(1);
+    }
+
+    // a socket left behind by a previous server is replaced
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+      unlink(path.c_str());
+
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0 || bind(listen_fd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, SOMAXCONN) != 0) {
+      printf("cannot listen on %s: %s, exiting\n", path.c_str(), strerror(errno));
+      exit(1);
+    }
+  }
+
+  /** Serve the connected clients until the process is terminated. */
+  [[noreturn]] void run(const handler_t &handle) {
+    std::vector<pollfd> fds;
+    while (true) {
+      // with requests left over from the previous turn, the clients are only polled
+      bool pending = false;
+      fds.assign(1, {listen_fd, POLLIN, 0});
+      for (auto &c : clients) {
+        fds.push_back({c.fd, (short)((c.closed ? 0 : POLLIN) | (c.out.empty() ? 0 : POLLOUT)), 0});
+        pending |= complete_request(c) != 0;
+      }
+
+      if (poll(fds.data(), fds.size(), pending ? 0 : -1) < 0 && errno != EINTR) {
+        printf("poll failed: %s, exiting\n", strerror(errno));
+        exit(1);
+      }
+
+      for (size_t i = 0; i < clients.size(); i++) {
+        client &c = clients[i];
+        short revents = fds[i + 1].revents;
+        if (!c.closed && (revents & (POLLIN | POLLHUP | POLLERR)))
+          c.closed |= !receive(c);
+
+        // a request too large to be sensible is answered and ends the connection
+        if (!c.closed && c.in.size() >= sizeof(ServerRequest)) {
+          const ServerRequest *req = (const ServerRequest *)c.in.data();
+          if ((uint64_t)req->num_params + req->num_direction_values > max_values) {
+            ServerResponse resp = {ServerResponse::malformed_request, 0, 0.0, 0, 0};
+            c.out.insert(c.out.end(), (char *)&resp, (char *)&resp + sizeof(resp));
+            c.in.clear();
+            c.closed = true;
+          }
+        }
+
+        // one request per client and turn
+        if (size_t len = complete_request(c)) {
+          const ServerRequest *req = (const ServerRequest *)c.in.data();
+          handle(*req, (const double *)(c.in.data() + sizeof(ServerRequest)), c.out);
+          c.in.erase(c.in.begin(), c.in.begin() + len);
+        }
+
+        if (!c.out.empty())
+          c.closed |= !send_pending(c);
+      }
+
+      // clients that closed their connection are dropped once their requests are answered
+      for (size_t i = 0; i < clients.size();) {
+        client &c = clients[i];
+        if (c.closed && (c.failed || (complete_request(c) == 0 && c.out.empty()))) {
+          close(c.fd);
+          clients.erase(clients.begin() + i);
+        } else {
+          i++;
+        }
+      }
+
+      if (fds[0].revents & POLLIN) {
+        int fd;
+        while ((fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+          clients.push_back({fd});
+      }
+    }
+  }
+
+private:
+  struct client {
+    int fd;
+    std::vector<char> in, out;
+    bool closed = false; /**< The client closed the connection or it failed. */
+    bool failed = false; /**< Nothing can be sent anymore. */
+  };
+
+  static const uint64_t max_values = 1 << 24; /**< Parameters and direction values per request. */
+
+  int listen_fd;
+  std::vector<client> clients;
+
+  /** Length of the first request in the client's input if it was received completely, else 0. */
+  static size_t complete_request(const client &c) {
+    if (c.in.size() < sizeof(ServerRequest))
+      return 0;
+    const ServerRequest *req = (const ServerRequest *)c.in.data();
+    size_t len = sizeof(ServerRequest) + ((size_t)req->num_params + req->num_direction_values) * sizeof(double);
+    return c.in.size() >= len ? len : 0;
+  }
+
+  /** Append the available input of the client, false if the connection was closed. */
+  static bool receive(client &c) {
+    char buf[1 << 16];
+    while (true) {
+      ssize_t n = read(c.fd, buf, sizeof(buf));
+      if (n > 0)
+        c.in.insert(c.in.end(), buf, buf + n);
+      else if (n < 0 && errno == EINTR)
+        continue;
+      else
+        return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+  }
+
+  /** Send as much of the pending output as possible, false if the connection failed. */
+  static bool send_pending(client &c) {
+    size_t sent = 0;
+    while (sent < c.out.size()) {
+      ssize_t n = send(c.fd, c.out.data() + sent, c.out.size() - sent, MSG_NOSIGNAL);
+      if (n > 0) {
+        sent += n;
+      } else if (n < 0 && errno == EINTR) {
+        continue;
+      } else {
+        c.out.erase(c.out.begin(), c.out.begin() + sent);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+          return true;
+        c.failed = true;
+        return false;
+      }
+    }
+    c.out.clear();
+    return true;
+  }
+};
@@ -29,7 +29,7 @@ public:
     assert(num_copied == nn_total_coeffs);
   }
 
-  void update_coeffs(array<adouble, num_inputs>& coeffs) {
+  void update_coeffs(aparams& coeffs) {
     adouble coeffs_[coeffs.size()];
     for (int i = 0; i < coeffs.size(); i++)
       coeffs_[i] = coeffs[i];
@@ -324,7 +324,6 @@ adouble _DiscoGrad_crowd(DiscoGrad<num_inputs> &_discograd, aparams &p)
   int total_num_measurement_evacs = 0;
 #endif
 
-  xdouble total_vel = 0;
   for (int step = 0; step < end_step; step++) {
     t_sim = step * delta_t;
 
@@ -406,8 +405,10 @@ adouble _DiscoGrad_crowd(DiscoGrad<num_inputs> &_discograd, aparams &p)
 
           npBt = n_prime * B * theta;
           nBt = n * B * theta;
-          force_v = -exp(-o_dist_norm / B - npBt * npBt) * int_dir;
-          force_angle = -theta_sign * exp(-o_dist_norm / B - nBt * nBt) * left_normal(int_dir);
+          xdouble force_exp[2] = {-o_dist_norm / B - npBt * npBt, -o_dist_norm / B - nBt * nBt};
+          amath::exp(std::span<xdouble>(force_exp));
+          force_v = -force_exp[0] * int_dir;
+          force_angle = -theta_sign * force_exp[1] * left_normal(int_dir);
 
           f_interaction += force_v + force_angle;
         } else {
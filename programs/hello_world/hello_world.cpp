@@ -37,7 +37,8 @@ int main(int argc, char **argv)
   DiscoGrad<num_inputs> dg(argc, argv, false);
   // instantiate the program wrapper for the heaviside function
   //HelloSmoothing prog;
-  DiscoGradFunc<num_inputs> func(dg, _DiscoGrad_heaviside);
+  // the function has no global state, so its estimation may run on multiple threads (--nt)
+  DiscoGradFunc<num_inputs> func(dg, _DiscoGrad_heaviside, true);
 
   // estimate or calculate output and gradient
   dg.estimate(func);
@@ -0,0 +1,44 @@
+/** Example of a recursive smoothed function: the number of steps a random walk
+ *  with a drift given as input takes to first reach a threshold. The exit time is
+ *  piecewise constant in the drift, so that its gradient is zero almost everywhere
+ *  without smoothing. The transformation gives the branches of a recursive cycle
+ *  positions shared by all of its calls, whose visits per sample are not known
+ *  statically. */
+
+const int num_inputs = 1;
+
+#include "backend/discograd.hpp"
+
+using namespace std;
+
+const double threshold = 1.0;
+const double step_stddev = 0.2;
+const int max_steps = 50;
+
+adouble _DiscoGrad_exit_time(DiscoGrad<num_inputs> &_discograd, adouble x, adouble &drift, int steps)
+{
+  if (steps == max_steps)
+    return steps;
+
+  x += drift + normal_distribution<double>(0.0, step_stddev)(_discograd.rng);
+  if (x >= threshold)
+    return steps + 1;
+
+  return _DiscoGrad_exit_time(_discograd, x, drift, steps + 1);
+}
+
+adouble _DiscoGrad_walk(DiscoGrad<num_inputs> &_discograd, aparams &p)
+{
+  return _DiscoGrad_exit_time(_discograd, 0.0, p[0], 0);
+}
+
+int main(int argc, char **argv)
+{
+  DiscoGrad<num_inputs> dg(argc, argv, false);
+  // the walk keeps no state outside of its calls, so it may be estimated on multiple threads (--nt)
+  DiscoGradFunc<num_inputs> func(dg, _DiscoGrad_walk, true);
+
+  dg.estimate(func);
+
+  return 0;
+}
@@ -214,7 +214,8 @@ adouble _DiscoGrad_simulate(DiscoGrad<num_inputs> &_discograd, aparams &params)
   //  printf("\n");
   //}
 
-  static Intersection r_grid[grid_width][grid_width], w_grid[grid_width][grid_width];
+  // reused across runs to keep the allocations of the lanes, one copy per estimation thread (--nt)
+  thread_local Intersection r_grid[grid_width][grid_width], w_grid[grid_width][grid_width];
 
   for (int is_y = 0; is_y < grid_width; is_y++) {
     for (int is_x = 0; is_x < grid_width; is_x++) {
@@ -308,7 +309,7 @@ adouble _DiscoGrad_simulate(DiscoGrad<num_inputs> &_discograd, aparams &params)
 int main(int argc, char **argv)
 {
   DiscoGrad<num_inputs> dg(argc, argv); //, true);
-  DiscoGradFunc<num_inputs> func(dg, _DiscoGrad_simulate);
+  DiscoGradFunc<num_inputs> func(dg, _DiscoGrad_simulate, true);
 
   dg.estimate(func);
 
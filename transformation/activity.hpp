@@ -0,0 +1,706 @@
+/** Finds the adouble variables and branches that can never depend on the program inputs
+ *
+ *  Copyright 2023, 2024 Philipp Andelfinger, Justin Kreikemeyer
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ *  and associated documentation files (the “Software”), to deal in the Software without
+ *  restriction, including without limitation the rights to use, copy, modify, merge, publish,
+ *  distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *    The above copyright notice and this permission notice shall be included in all copies or
+ *    substantial portions of the Software.
+ *
+ *    THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ *    INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ *    PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ *    ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ *    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *    SOFTWARE.
+ */
+
+#pragma once
+
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/ParentMapContext.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+/** Flow-insensitive dataflow analysis over the functions of the main file.
+ *  Variables, fields and function results are nodes, where a field stands for that
+ *  member of all objects. Assignments, initializations, argument passing and
+ *  returns are edges. References and pointers connect the aliased nodes in both
+ *  directions. Activity starts at the non-arithmetic parameters of the _DiscoGrad_
+ *  functions and of all functions that may be called from outside the main file,
+ *  e.g., run(), overloaded operators or lambdas passed to the standard library.
+ *  Values of arithmetic type carry no tangent and cut the flow. Declarations
+ *  from headers are not traversed.
+ *
+ *  Calls to functions without a body in the main file are assumed to pass the
+ *  activity of all arguments to the result and to everything they receive by
+ *  non-const reference or pointer. If an active value may be written to a
+ *  location the analysis cannot name, every expression is considered active.
+ *
+ *  The local adouble variables that stay inactive are retyped to double if all
+ *  their uses remain valid C++ with a double, which requires that no use relies
+ *  on members of adouble, non-const references or template argument deduction.
+ */
+class ActivityAnalysis : public clang::RecursiveASTVisitor<ActivityAnalysis> {
+public:
+  explicit ActivityAnalysis(clang::ASTContext *Context) : Context(Context), srcMgr(Context->getSourceManager()) {}
+
+  bool shouldVisitTemplateInstantiations() const { return true; }
+
+  bool TraverseDecl(clang::Decl *D) {
+    if (D != nullptr && !clang::isa<clang::TranslationUnitDecl>(D) && !inMainFile(D->getLocation()))
+      return true;
+    return clang::RecursiveASTVisitor<ActivityAnalysis>::TraverseDecl(D);
+  }
+
+  void run() {
+    TraverseDecl(Context->getTranslationUnitDecl());
+    seedEntryPoints();
+    propagate();
+    for (auto &src : unknownWrites)
+      if (anyActive(src))
+        gaveUp = true;
+    selectPassiveVars();
+    ran = true;
+  }
+
+  /** Whether the value of e may depend on the program inputs. */
+  bool isActive(const clang::Expr *e) {
+    if (!ran || gaveUp)
+      return true;
+    if (isPassiveType(e->getType())) {
+      for (const clang::Stmt *c : e->children())
+        if (auto *ce = clang::dyn_cast_or_null<clang::Expr>(c); ce && isActive(ce))
+          return true;
+      return false;
+    }
+    Sources src;
+    collectSources(e, src);
+    return anyActive(src);
+  }
+
+  /** Inactive local adouble variables that can be declared as double instead. */
+  const std::set<const clang::VarDecl *> &getPassiveVars() const { return passiveVars; }
+
+  bool VisitFunctionDecl(clang::FunctionDecl *f) {
+    if (f->doesThisDeclarationHaveABody() && inMainFile(f->getLocation()) && !f->isDependentContext())
+      functions.push_back(f);
+    return true;
+  }
+
+  bool VisitLambdaExpr(clang::LambdaExpr *e) {
+    if (relevant(e))
+      functions.push_back(e->getCallOperator());
+    return true;
+  }
+
+  bool VisitCallExpr(clang::CallExpr *call) {
+    const clang::FunctionDecl *f = call->getDirectCallee();
+    if (call->isInstantiationDependent() || !relevant(call))
+      return true;
+
+    if (auto *ref = clang::dyn_cast<clang::DeclRefExpr>(call->getCallee()->IgnoreParenImpCasts()))
+      calleeRefs.insert(ref);
+    if (f != nullptr)
+      calledFunctions.insert(f->getCanonicalDecl());
+
+    std::vector<const clang::Expr *> args(call->arg_begin(), call->arg_end());
+    const clang::Expr *object = nullptr;
+    if (auto *mc = clang::dyn_cast<clang::CXXMemberCallExpr>(call)) {
+      object = mc->getImplicitObjectArgument();
+    } else if (clang::isa<clang::CXXOperatorCallExpr>(call) && llvm::isa_and_nonnull<clang::CXXMethodDecl>(f) && !args.empty()) {
+      object = args[0];
+      args.erase(args.begin());
+    }
+
+    auto *oc = clang::dyn_cast<clang::CXXOperatorCallExpr>(call);
+    if (oc != nullptr && oc->isAssignmentOp() && oc->getNumArgs() == 2)
+      write(oc->getArg(0), sourcesOf(oc->getArg(1)));
+
+    handleCall(f, object, args);
+    return true;
+  }
+
+  bool VisitCXXConstructExpr(clang::CXXConstructExpr *e) {
+    if (e->isInstantiationDependent() || !relevant(e))
+      return true;
+    calledFunctions.insert(e->getConstructor()->getCanonicalDecl());
+    handleCall(e->getConstructor(), nullptr, std::vector<const clang::Expr *>(e->arg_begin(), e->arg_end()));
+    return true;
+  }
+
+  bool VisitDeclRefExpr(clang::DeclRefExpr *e) {
+    if (!relevant(e))
+      return true;
+    if (auto *f = clang::dyn_cast<clang::FunctionDecl>(e->getDecl()); f && !calleeRefs.count(e))
+      indirectlyReferenced.insert(f->getCanonicalDecl());
+    if (auto *v = clang::dyn_cast<clang::VarDecl>(e->getDecl()); v && v->isLocalVarDecl())
+      varUses[v].push_back(e);
+    return true;
+  }
+
+  bool VisitBinaryOperator(clang::BinaryOperator *e) {
+    if (!relevant(e) || !e->isAssignmentOp())
+      return true;
+    write(e->getLHS(), sourcesOf(e->getRHS()));
+    if (e->getOpcode() == clang::BO_Assign && e->getLHS()->getType()->isPointerType())
+      alias(e->getLHS(), e->getRHS());
+    return true;
+  }
+
+  bool VisitVarDecl(clang::VarDecl *v) {
+    if (!inMainFile(v->getLocation()) || v->getDeclContext()->isDependentContext() || clang::isa<clang::ParmVarDecl>(v))
+      return true;
+    if (const clang::Expr *init = v->getInit())
+      flowInto(v, init);
+    if (v->isLocalVarDecl() && v->getType().getAsString() == "adouble" && hasExplicitInit(v) && !inTemplate(v))
+      candidates.insert(v);
+    return true;
+  }
+
+  bool VisitDeclStmt(clang::DeclStmt *s) {
+    if (!relevant(s) || s->isSingleDecl())
+      return true;
+    std::vector<const clang::VarDecl *> group;
+    for (const clang::Decl *d : s->decls())
+      if (auto *v = clang::dyn_cast<clang::VarDecl>(d))
+        group.push_back(v);
+    declGroups.push_back(group);
+    return true;
+  }
+
+  bool VisitCXXForRangeStmt(clang::CXXForRangeStmt *s) {
+    if (relevant(s) && s->getLoopVariable() != nullptr && s->getRangeInit() != nullptr && !s->getRangeInit()->isInstantiationDependent())
+      flowInto(s->getLoopVariable(), s->getRangeInit());
+    return true;
+  }
+
+  bool VisitReturnStmt(clang::ReturnStmt *s) {
+    const clang::Expr *value = s->getRetValue();
+    if (!relevant(s) || value == nullptr || value->isInstantiationDependent())
+      return true;
+    if (const clang::FunctionDecl *f = enclosingFunction(s))
+      flowInto(f, value);
+    return true;
+  }
+
+  bool VisitCXXConstructorDecl(clang::CXXConstructorDecl *c) {
+    if (!c->doesThisDeclarationHaveABody() || !inMainFile(c->getLocation()) || c->isDependentContext())
+      return true;
+    for (const clang::CXXCtorInitializer *init : c->inits())
+      if (init->isMemberInitializer() && init->isWritten())
+        flowInto(init->getMember(), init->getInit());
+    return true;
+  }
+
+private:
+  /** The nodes an expression reads from, and whether it is active regardless. */
+  struct Sources {
+    std::set<const clang::Decl *> decls;
+    bool always = false;
+  };
+
+  clang::ASTContext *Context;
+  clang::SourceManager &srcMgr;
+  bool ran = false;
+  bool gaveUp = false;
+
+  std::map<const clang::Decl *, std::set<const clang::Decl *>> flows;
+  std::set<const clang::Decl *> active;
+  std::set<const clang::Decl *> seeds;
+  std::vector<Sources> unknownWrites;
+
+  std::vector<const clang::FunctionDecl *> functions;
+  std::set<const clang::FunctionDecl *> calledFunctions, indirectlyReferenced;
+  std::set<const clang::DeclRefExpr *> calleeRefs;
+
+  std::set<const clang::VarDecl *> candidates;
+  std::map<const clang::VarDecl *, std::vector<const clang::DeclRefExpr *>> varUses;
+  std::vector<std::vector<const clang::VarDecl *>> declGroups;
+  std::set<const clang::VarDecl *> passiveVars;
+
+  bool inMainFile(clang::SourceLocation loc) const {
+    return loc.isValid() && srcMgr.isInMainFile(srcMgr.getExpansionLoc(loc));
+  }
+
+  bool relevant(const clang::Stmt *s) const { return inMainFile(s->getBeginLoc()); }
+
+  /** Types that cannot hold a tangent, also behind pointers and arrays. */
+  static bool isPassiveType(clang::QualType t) {
+    clang::QualType q = t.getNonReferenceType().getCanonicalType();
+    while (q->isPointerType() || q->isArrayType())
+      q = q->isPointerType() ? q->getPointeeType() : clang::QualType(q->getArrayElementTypeNoTypeQual(), 0);
+    return q->isArithmeticType() || q->isEnumeralType();
+  }
+
+  /** The DiscoGrad object only carries the backend state, e.g., the random number generator. */
+  static bool isDiscoGradType(clang::QualType t) {
+    return t.getNonReferenceType().getCanonicalType().getAsString().find("DiscoGrad") != std::string::npos;
+  }
+
+  static bool mayWriteThrough(clang::QualType t) {
+    if (t->isReferenceType())
+      return !t.getNonReferenceType().isConstQualified();
+    return t->isPointerType() && !t->getPointeeType().isConstQualified();
+  }
+
+  static clang::QualType declType(const clang::Decl *d) {
+    if (auto *f = clang::dyn_cast<clang::FunctionDecl>(d))
+      return f->getReturnType();
+    return clang::cast<clang::ValueDecl>(d)->getType();
+  }
+
+  /** The definition of f if its body is analyzed. */
+  const clang::FunctionDecl *analyzedDefinition(const clang::FunctionDecl *f) const {
+    const clang::FunctionDecl *def = nullptr;
+    if (f == nullptr || !f->hasBody(def) || def == nullptr || !inMainFile(def->getLocation()) || def->isDependentContext())
+      return nullptr;
+    return def;
+  }
+
+  const clang::FunctionDecl *enclosingFunction(const clang::Stmt *s) {
+    clang::DynTypedNodeList parents = Context->getParents(*s);
+    while (!parents.empty()) {
+      if (auto *l = parents[0].get<clang::LambdaExpr>())
+        return l->getCallOperator();
+      if (auto *f = parents[0].get<clang::FunctionDecl>())
+        return f;
+      if (auto *p = parents[0].get<clang::Stmt>())
+        parents = Context->getParents(*p);
+      else if (auto *d = parents[0].get<clang::Decl>())
+        parents = Context->getParents(*d);
+      else
+        break;
+    }
+    return nullptr;
+  }
+
+  static bool inTemplate(const clang::VarDecl *v) {
+    for (const clang::DeclContext *dc = v->getDeclContext(); dc != nullptr; dc = dc->getParent())
+      if (auto *f = clang::dyn_cast<clang::FunctionDecl>(dc); f && (f->isTemplated() || f->isTemplateInstantiation()))
+        return true;
+    return false;
+  }
+
+  static bool hasExplicitInit(const clang::VarDecl *v) {
+    const clang::Expr *init = v->getInit();
+    if (init == nullptr)
+      return false;
+    auto *c = clang::dyn_cast<clang::CXXConstructExpr>(init->IgnoreImplicit());
+    return c == nullptr || c->getNumArgs() > 0;
+  }
+
+  void collectSources(const clang::Stmt *s, Sources &src) {
+    if (s == nullptr || clang::isa<clang::LambdaExpr>(s) || clang::isa<clang::UnaryExprOrTypeTraitExpr>(s))
+      return;
+    if (auto *e = clang::dyn_cast<clang::Expr>(s)) {
+      if (isPassiveType(e->getType()) || isDiscoGradType(e->getType()))
+        return;
+      // fields are shared by all objects of a type, the object as a whole reads all of them
+      clang::QualType t = e->getType().getNonReferenceType();
+      if (t->isPointerType())
+        t = t->getPointeeType();
+      collectFields(t->getAsCXXRecordDecl(), src);
+    }
+
+    if (auto *ref = clang::dyn_cast<clang::DeclRefExpr>(s)) {
+      if (auto *v = clang::dyn_cast<clang::VarDecl>(ref->getDecl()))
+        src.decls.insert(v->getCanonicalDecl());
+      return;
+    }
+    if (auto *me = clang::dyn_cast<clang::MemberExpr>(s)) {
+      if (auto *f = clang::dyn_cast<clang::FieldDecl>(me->getMemberDecl()))
+        src.decls.insert(f->getCanonicalDecl());
+      else
+        collectSources(me->getBase(), src);
+      return;
+    }
+    if (auto *call = clang::dyn_cast<clang::CallExpr>(s)) {
+      if (const clang::FunctionDecl *def = analyzedDefinition(call->getDirectCallee())) {
+        src.decls.insert(def->getCanonicalDecl());
+        return;
+      }
+      // e.g., _discograd.custom_op()
+      if (auto *mc = clang::dyn_cast<clang::CXXMemberCallExpr>(call); mc && isDiscoGradType(mc->getImplicitObjectArgument()->getType()))
+        src.always = true;
+    }
+
+    for (const clang::Stmt *c : s->children())
+      collectSources(c, src);
+  }
+
+  void collectFields(const clang::CXXRecordDecl *record, Sources &src) {
+    if (record == nullptr || !record->hasDefinition() || !inMainFile(record->getLocation()))
+      return;
+    for (const clang::FieldDecl *f : record->getDefinition()->fields()) {
+      if (!src.decls.insert(f->getCanonicalDecl()).second || isPassiveType(f->getType()))
+        continue;
+      collectFields(f->getType().getNonReferenceType()->getAsCXXRecordDecl(), src);
+    }
+  }
+
+  Sources sourcesOf(const clang::Expr *e) {
+    Sources src;
+    collectSources(e, src);
+    return src;
+  }
+
+  bool anyActive(const Sources &src) const {
+    if (src.always)
+      return true;
+    for (const clang::Decl *d : src.decls)
+      if (active.count(d))
+        return true;
+    return false;
+  }
+
+  /** Adds the nodes an assignment to e may change. Returns false if these are unknown. */
+  bool collectTargets(const clang::Expr *e, std::set<const clang::Decl *> &targets) {
+    e = e->IgnoreParenCasts();
+    if (isDiscoGradType(e->getType()) || (!e->isGLValue() && !e->getType()->isPointerType()))
+      return true; // temporaries
+
+    if (auto *ref = clang::dyn_cast<clang::DeclRefExpr>(e)) {
+      if (auto *v = clang::dyn_cast<clang::VarDecl>(ref->getDecl()))
+        targets.insert(v->getCanonicalDecl());
+      return true;
+    }
+    if (auto *t = clang::dyn_cast<clang::CXXThisExpr>(e)) {
+      if (const clang::CXXRecordDecl *record = t->getType()->getPointeeCXXRecordDecl())
+        for (const clang::FieldDecl *f : record->fields())
+          targets.insert(f->getCanonicalDecl());
+      return true;
+    }
+    if (clang::isa<clang::CXXNewExpr>(e))
+      return true;
+    if (auto *me = clang::dyn_cast<clang::MemberExpr>(e)) {
+      auto *f = clang::dyn_cast<clang::FieldDecl>(me->getMemberDecl());
+      if (f != nullptr)
+        targets.insert(f->getCanonicalDecl());
+      return f != nullptr;
+    }
+    if (auto *ase = clang::dyn_cast<clang::ArraySubscriptExpr>(e))
+      return collectTargets(ase->getBase(), targets);
+    if (auto *uo = clang::dyn_cast<clang::UnaryOperator>(e))
+      return collectTargets(uo->getSubExpr(), targets);
+    if (auto *bo = clang::dyn_cast<clang::BinaryOperator>(e)) {
+      if (bo->isAssignmentOp())
+        return collectTargets(bo->getLHS(), targets);
+      if (bo->getOpcode() == clang::BO_Comma)
+        return collectTargets(bo->getRHS(), targets);
+      if (bo->isAdditiveOp())
+        return collectTargets(bo->getLHS()->getType()->isPointerType() ? bo->getLHS() : bo->getRHS(), targets);
+      return false;
+    }
+    if (auto *co = clang::dyn_cast<clang::ConditionalOperator>(e)) {
+      bool known = collectTargets(co->getTrueExpr(), targets);
+      return collectTargets(co->getFalseExpr(), targets) && known;
+    }
+    if (auto *call = clang::dyn_cast<clang::CallExpr>(e)) {
+      if (const clang::FunctionDecl *def = analyzedDefinition(call->getDirectCallee())) {
+        targets.insert(def->getCanonicalDecl());
+        return true;
+      }
+      if (auto *mc = clang::dyn_cast<clang::CXXMemberCallExpr>(call))
+        return collectTargets(mc->getImplicitObjectArgument(), targets);
+      if (auto *oc = clang::dyn_cast<clang::CXXOperatorCallExpr>(call))
+        return oc->getNumArgs() > 0 && collectTargets(oc->getArg(0), targets);
+      bool known = false;
+      for (const clang::Expr *arg : call->arguments())
+        known |= collectTargets(arg, targets);
+      return known;
+    }
+    return false;
+  }
+
+  void addFlows(const Sources &src, const clang::Decl *dst) {
+    for (const clang::Decl *d : src.decls)
+      flows[d].insert(dst);
+    if (src.always)
+      seeds.insert(dst);
+  }
+
+  void write(const clang::Expr *e, const Sources &src) {
+    if (src.decls.empty() && !src.always)
+      return;
+    std::set<const clang::Decl *> targets;
+    if (!collectTargets(e, targets)) {
+      unknownWrites.push_back(src);
+      return;
+    }
+    for (const clang::Decl *t : targets)
+      addFlows(src, t);
+  }
+
+  /** Connect the nodes that the lvalues or pointers a and b refer to in both directions. */
+  void alias(const clang::Expr *a, const clang::Expr *b) {
+    std::set<const clang::Decl *> ta, tb;
+    bool known = collectTargets(a, ta) & collectTargets(b, tb);
+    aliasNodes(ta, tb, known);
+  }
+
+  void aliasNodes(const std::set<const clang::Decl *> &ta, const std::set<const clang::Decl *> &tb, bool known) {
+    Sources all;
+    for (auto *x : ta) {
+      all.decls.insert(x);
+      for (auto *y : tb) {
+        flows[x].insert(y);
+        flows[y].insert(x);
+      }
+    }
+    all.decls.insert(tb.begin(), tb.end());
+    if (!known)
+      unknownWrites.push_back(all);
+  }
+
+  /** Initialize dst, a variable, field, parameter or function result, from e. */
+  void flowInto(const clang::Decl *dst, const clang::Expr *e) {
+    dst = dst->getCanonicalDecl();
+    addFlows(sourcesOf(e), dst);
+    if (mayWriteThrough(declType(dst))) {
+      std::set<const clang::Decl *> targets;
+      bool known = collectTargets(e, targets);
+      aliasNodes({dst}, targets, known);
+    }
+  }
+
+  void handleCall(const clang::FunctionDecl *callee, const clang::Expr *object, const std::vector<const clang::Expr *> &args) {
+    if (const clang::FunctionDecl *def = analyzedDefinition(callee)) {
+      for (unsigned i = 0; i < def->getNumParams() && i < args.size(); i++)
+        flowInto(def->getParamDecl(i), args[i]);
+      return;
+    }
+
+    Sources src;
+    if (object != nullptr)
+      collectSources(object, src);
+    for (const clang::Expr *arg : args)
+      collectSources(arg, src);
+
+    auto *method = clang::dyn_cast_or_null<clang::CXXMethodDecl>(callee);
+    if (object != nullptr && !(method != nullptr && method->isConst()))
+      write(object, src);
+    for (unsigned i = 0; i < args.size(); i++) {
+      bool known = callee != nullptr && i < callee->getNumParams();
+      if (!known || mayWriteThrough(callee->getParamDecl(i)->getType()))
+        if (args[i]->isGLValue() || args[i]->getType()->isPointerType())
+          write(args[i], src);
+    }
+  }
+
+  void seedEntryPoints() {
+    for (const clang::FunctionDecl *f : functions) {
+      const clang::FunctionDecl *c = f->getCanonicalDecl();
+      auto *m = clang::dyn_cast<clang::CXXMethodDecl>(f);
+      // overloaded operators may also be called from instantiations of header templates, e.g., by std::sort
+      bool entry = f->getNameAsString().find("_DiscoGrad_") != std::string::npos || !calledFunctions.count(c) ||
+                   indirectlyReferenced.count(c) || f->isOverloadedOperator() || (m != nullptr && m->size_overridden_methods() > 0);
+      if (!entry)
+        continue;
+      for (const clang::ParmVarDecl *p : f->parameters())
+        if (!isPassiveType(p->getType()) && !isDiscoGradType(p->getType()))
+          seeds.insert(p->getCanonicalDecl());
+    }
+  }
+
+  void propagate() {
+    std::vector<const clang::Decl *> worklist(seeds.begin(), seeds.end());
+    active.insert(seeds.begin(), seeds.end());
+    while (!worklist.empty()) {
+      const clang::Decl *d = worklist.back();
+      worklist.pop_back();
+      for (const clang::Decl *next : flows[d])
+        if (active.insert(next).second)
+          worklist.push_back(next);
+    }
+  }
+
+  /* Retyping */
+
+  static bool isMathFunction(const clang::FunctionDecl *f) {
+    static const std::set<std::string> names = {"exp", "log", "sqrt", "sin", "cos", "tanh", "erf", "atan2", "abs", "fabs", "pow", "min", "max"};
+    return f != nullptr && names.count(f->getNameAsString());
+  }
+
+  static bool isArithmeticOp(clang::OverloadedOperatorKind op) {
+    return op == clang::OO_Plus || op == clang::OO_Minus || op == clang::OO_Star || op == clang::OO_Slash;
+  }
+
+  static bool isComparisonOp(clang::OverloadedOperatorKind op) {
+    return op == clang::OO_Less || op == clang::OO_Greater || op == clang::OO_LessEqual || op == clang::OO_GreaterEqual ||
+           op == clang::OO_EqualEqual || op == clang::OO_ExclaimEqual;
+  }
+
+  /** Nodes that do not change the value of their only operand. */
+  static const clang::Expr *transparentOperand(const clang::Expr *e) {
+    if (auto *p = clang::dyn_cast<clang::ParenExpr>(e))
+      return p->getSubExpr();
+    if (auto *c = clang::dyn_cast<clang::ImplicitCastExpr>(e))
+      return c->getSubExpr();
+    if (auto *m = clang::dyn_cast<clang::MaterializeTemporaryExpr>(e))
+      return m->getSubExpr();
+    if (auto *b = clang::dyn_cast<clang::CXXBindTemporaryExpr>(e))
+      return b->getSubExpr();
+    if (auto *f = clang::dyn_cast<clang::ExprWithCleanups>(e))
+      return f->getSubExpr();
+    auto *c = clang::dyn_cast<clang::CXXConstructExpr>(e);
+    if (c != nullptr && !clang::isa<clang::CXXTemporaryObjectExpr>(c) && c->getNumArgs() == 1 &&
+        (c->getConstructor()->isCopyOrMoveConstructor() || c->getArg(0)->getType()->isArithmeticType()))
+      return c->getArg(0);
+    return nullptr;
+  }
+
+  static const clang::Expr *stripConversions(const clang::Expr *e) {
+    while (const clang::Expr *sub = transparentOperand(e))
+      e = sub;
+    return e;
+  }
+
+  /** Whether e has type double once the variables in vars are retyped. */
+  bool isDoubleAfter(const clang::Expr *e, const std::set<const clang::VarDecl *> &vars) {
+    e = stripConversions(e);
+    if (e->getType()->isArithmeticType())
+      return true;
+    if (auto *ref = clang::dyn_cast<clang::DeclRefExpr>(e))
+      return vars.count(clang::dyn_cast<clang::VarDecl>(ref->getDecl()));
+    if (auto *co = clang::dyn_cast<clang::ConditionalOperator>(e))
+      return isDoubleAfter(co->getTrueExpr(), vars) && isDoubleAfter(co->getFalseExpr(), vars);
+
+    auto *call = clang::dyn_cast<clang::CallExpr>(e);
+    if (call == nullptr)
+      return false;
+    if (auto *oc = clang::dyn_cast<clang::CXXOperatorCallExpr>(call); oc && !isArithmeticOp(oc->getOperator()))
+      return false;
+    if (!clang::isa<clang::CXXOperatorCallExpr>(call) && !isMathFunction(call->getDirectCallee()))
+      return false;
+    for (const clang::Expr *arg : call->arguments())
+      if (!isDoubleAfter(arg, vars))
+        return false;
+    return true;
+  }
+
+  /** Whether an argument of type double can be passed as parameter i of f. */
+  static bool acceptsDouble(const clang::FunctionDecl *f, unsigned i) {
+    if (f == nullptr || f->isTemplateInstantiation() || f->getPrimaryTemplate() != nullptr || i >= f->getNumParams())
+      return false;
+    clang::QualType t = f->getParamDecl(i)->getType();
+    return !t->isRValueReferenceType() && !(t->isLValueReferenceType() && !t.getNonReferenceType().isConstQualified());
+  }
+
+  /** Whether the value of e may become a double without changing the meaning of its use. */
+  bool useAllowed(const clang::Expr *e, const std::set<const clang::VarDecl *> &vars) {
+    while (true) {
+      clang::DynTypedNodeList parents = Context->getParents(*e);
+      if (parents.empty())
+        return false;
+
+      if (auto *v = parents[0].get<clang::VarDecl>())
+        return !v->getType()->getContainedAutoType() && !v->getType()->isReferenceType();
+
+      auto *parent = parents[0].get<clang::Expr>();
+      if (parent != nullptr && transparentOperand(parent) == e) {
+        e = parent;
+        continue;
+      }
+
+      if (auto *ret = parents[0].get<clang::ReturnStmt>()) {
+        const clang::FunctionDecl *f = enclosingFunction(ret);
+        return f != nullptr && !f->getDeclaredReturnType()->getContainedAutoType() && !f->getReturnType()->isReferenceType();
+      }
+      if (parent == nullptr)
+        return false;
+      if (clang::isa<clang::InitListExpr>(parent))
+        return true;
+
+      if (auto *oc = clang::dyn_cast<clang::CXXOperatorCallExpr>(parent)) {
+        clang::OverloadedOperatorKind op = oc->getOperator();
+        if (isComparisonOp(op))
+          return true;
+        if (oc->isAssignmentOp()) {
+          clang::DynTypedNodeList up = Context->getParents(*oc);
+          bool isStatement = up.empty() || !up[0].get<clang::Expr>() || up[0].get<clang::ExprWithCleanups>();
+          return isStatement && (oc->getArg(0) != e || isDoubleAfter(oc->getArg(1), vars));
+        }
+        if (!isArithmeticOp(op))
+          return false;
+        if (!isDoubleAfter(oc, vars))
+          return true; // resolves to the mixed double/adouble overload
+        e = oc;
+        continue;
+      }
+
+      if (auto *call = clang::dyn_cast<clang::CallExpr>(parent)) {
+        auto args = call->arguments();
+        auto it = std::find(args.begin(), args.end(), e);
+        if (it == args.end())
+          return false;
+        if (isMathFunction(call->getDirectCallee())) {
+          if (!isDoubleAfter(call, vars))
+            return false;
+          e = call;
+          continue;
+        }
+        return acceptsDouble(call->getDirectCallee(), it - args.begin());
+      }
+
+      if (auto *c = clang::dyn_cast<clang::CXXConstructExpr>(parent)) {
+        auto args = c->arguments();
+        auto it = std::find(args.begin(), args.end(), e);
+        return it != args.end() && acceptsDouble(c->getConstructor(), it - args.begin());
+      }
+
+      return false;
+    }
+  }
+
+  bool retypable(const clang::VarDecl *v, const std::set<const clang::VarDecl *> &vars) {
+    if (!isDoubleAfter(v->getInit(), vars))
+      return false;
+    for (const clang::DeclRefExpr *use : varUses[v])
+      if (!useAllowed(use, vars))
+        return false;
+    return true;
+  }
+
+  void selectPassiveVars() {
+    if (gaveUp)
+      return;
+
+    std::set<const clang::VarDecl *> vars;
+    for (const clang::VarDecl *v : candidates)
+      if (!active.count(v->getCanonicalDecl()))
+        vars.insert(v);
+
+    // retyping one variable can invalidate the uses of another
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (auto it = vars.begin(); it != vars.end();) {
+        if (retypable(*it, vars)) {
+          ++it;
+        } else {
+          it = vars.erase(it);
+          changed = true;
+        }
+      }
+      // declarations that share the type specifier are retyped together
+      for (auto &group : declGroups) {
+        bool all = true;
+        for (const clang::VarDecl *v : group)
+          all &= vars.count(v) > 0;
+        if (!all)
+          for (const clang::VarDecl *v : group)
+            changed |= vars.erase(v) > 0;
+      }
+    }
+    passiveVars = vars;
+  }
+};
@@ -0,0 +1,285 @@
+#!/bin/bash
+
+# Copyright 2023, 2024 Philipp Andelfinger, Justin Kreikemeyer
+# 
+# Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+# and associated documentation files (the “Software”), to deal in the Software without
+# restriction, including without limitation the rights to use, copy, modify, merge, publish,
+# distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#  
+#   The above copyright notice and this permission notice shall be included in all copies or
+#   substantial portions of the Software.
+#   
+#   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+#   INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+#   PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+#   ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+#   ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+#   SOFTWARE.
+# Compares the output of dgo_transform with that of the separate passes it replaces
+# (normalize | smooth_dgo | insert_func_incr, each followed by clang-format) for the given
+# programs, or for all programs under programs/. Intended differences in the emitted code are
+# canonicalized before the comparison: the branch capacity table is dropped (and reported),
+# prepare_branch<N>(c) becomes prepare_branch(N, c), and ranged inc_branch_visits(first, last)
+# calls are expanded into sorted single inc_branch_visit calls. For each program, the branch
+# positions of the transformed sources are checked for consistency, the declarations retyped by
+# the activity analysis are listed and the transformed source is compiled as a DGO version.
+#
+# usage (from the repository root):
+#   transformation/check_dgo_transform.sh <baseline_tools_dir> [program.cpp ...]
+#
+# <baseline_tools_dir> holds normalize, smooth_dgo and insert_func_incr built from the revision
+# to compare against, e.g.:
+#   git worktree add /tmp/discograd_base <revision>
+#   (cd /tmp/discograd_base/transformation && cmake . && make -j)
+#   transformation/check_dgo_transform.sh /tmp/discograd_base/transformation
+#
+# Additional compiler flags can be passed via CHECK_FLAGS, e.g., for ac_torch:
+#   CHECK_FLAGS="-I$libtorch_root/include -I$libtorch_root/include/torch/csrc/api/include" \
+#     transformation/check_dgo_transform.sh /tmp/discograd_base/transformation programs/ac/ac_torch/ac.cpp
+# If CHECK_OUTPUT_DIR is set, the sources generated by the passes and by dgo_transform and the
+# diff between them are kept there for each program. The exit status is non-zero if any program
+# differs or fails.
+
+set -o pipefail
+
+base_dir=$1
+shift
+if [ ! -x "$base_dir/normalize" ] || [ ! -x "$base_dir/smooth_dgo" ] || [ ! -x "$base_dir/insert_func_incr" ]; then
+  echo "usage: $0 <baseline_tools_dir> [program.cpp ...]" >&2
+  exit 1
+fi
+if [ ! -x ./transformation/dgo_transform ]; then
+  echo "./transformation/dgo_transform not found, build the transformation code first" >&2
+  exit 1
+fi
+
+srcs=("$@")
+if [ ${#srcs[@]} -eq 0 ]; then
+  srcs=($(grep -rl --include='*.cpp' _DiscoGrad_ programs | grep -Ev '_(normalized|smoothed|dgo|all)\.cpp$' | sort))
+fi
+
+function preface {
+  echo -n "$1"
+  local d="${1-}" f=${2-}
+  if shift 2; then
+    printf %s "$f" "${@/#/ $d}"
+  fi
+}
+
+cpp_flags="-Wall -std=c++20 -Ibackend $CHECK_FLAGS"
+smooth_flags=$(preface --extra-arg= $cpp_flags -DNO_AD -DCRISP -Wno-unused-command-line-argument)
+insert_func_incr_flags=$(preface --extra-arg= $cpp_flags -DAD -DDGO -Wno-unused-command-line-argument)
+CPATH=$CPATH:$(clang++ -v 2>&1| grep 'Selected GCC installation' | awk '{print $NF}')/include
+export CPATH
+
+function now {
+  date +%s.%N
+}
+
+function elapsed {
+  awk -v from=$1 -v to=$2 'BEGIN { printf "%.2f", to - from }'
+}
+
+# the number of visit calls and of the visits they count
+function visit_calls {
+  awk '/^[ \t]*_discograd\.inc_branch_visits?\([0-9]+(, *[0-9]+)?\);$/ {
+         args = $0
+         sub(/^[^(]*\(/, "", args)
+         sub(/\);$/, "", args)
+         k = split(args, r, /, */)
+         calls++
+         visits += r[k] - r[1] + 1
+       }
+       END { printf "%d calls counting %d visits", calls, visits }' $1
+}
+
+# the branch capacity table of a transformed source as position:capacity pairs, where 0 stands
+# for DGO_PREALLOC_BRANCH_DATA
+function capacities {
+  awk '/^constexpr unsigned long _discograd_branch_capacity\[\]/ { t = 1 }
+       t { s = s " " $0 } t && /};/ { exit }
+       END {
+         sub(/^[^{]*{/, "", s)
+         sub(/}.*/, "", s)
+         n = split(s, c, /[ \t]*,[ \t]*/)
+         for (i = 1; i <= n; i++) {
+           gsub(/[ \t]/, "", c[i])
+           printf " %d:%s", i - 1, c[i]
+         }
+       }' $1
+}
+
+# a transformed source with the intended differences between the passes and dgo_transform removed
+function canonicalize {
+  awk '
+    function flush(  i, j, t) {
+      for (i = 2; i <= n; i++)
+        for (j = i; j > 1 && pos[j - 1] > pos[j]; j--) {
+          t = pos[j]; pos[j] = pos[j - 1]; pos[j - 1] = t
+        }
+      for (i = 1; i <= n; i++)
+        print indent "_discograd.inc_branch_visit(" pos[i] ");"
+      n = 0
+    }
+    /^constexpr unsigned long _discograd_branch_capacity\[\]/ { skip = 1 }
+    skip { if (/};/) skip = 0; next }
+    /^[ \t]*_discograd\.inc_branch_visits?\([0-9]+(, *[0-9]+)?\);$/ {
+      if (n == 0) {
+        indent = $0
+        sub(/[^ \t].*/, "", indent)
+      }
+      args = $0
+      sub(/^[^(]*\(/, "", args)
+      sub(/\);$/, "", args)
+      k = split(args, r, /, */)
+      for (p = r[1] + 0; p <= r[k] + 0; p++)
+        pos[++n] = p
+      next
+    }
+    { flush() }
+    /prepare_branch</ { $0 = canonical_prepare($0) }
+    { print }
+    END { flush() }
+    function canonical_prepare(s,  pre, num) {
+      while (match(s, /\.(template )?prepare_branch<[0-9]+>\(/)) {
+        pre = substr(s, 1, RSTART - 1)
+        num = substr(s, RSTART, RLENGTH)
+        sub(/^[^<]*</, "", num)
+        sub(/>\($/, "", num)
+        s = pre ".prepare_branch(" num ", " substr(s, RSTART + RLENGTH)
+      }
+      return s
+    }' $1
+}
+
+# problems with the branch positions of a transformed source: the prepared positions have to be
+# 0 to _discograd_max_branch_pos, each prepared at one place, only prepared positions may be
+# counted as visited, ranged visit calls have to be non-empty, and there has to be a capacity
+# for each position
+function check_positions {
+  awk '
+    /^const int _discograd_max_branch_pos = [0-9]+;/ {
+      max_pos = $0
+      gsub(/[^0-9]/, "", max_pos)
+    }
+    /^constexpr unsigned long _discograd_branch_capacity\[\]/ { t = 1 }
+    t {
+      s = $0
+      sub(/^.*{/, "", s)
+      sub(/}.*/, "", s)
+      num_capacities += split(s, c, /,/)
+      if (s ~ /,[ \t]*$/)
+        num_capacities--
+    }
+    t && /};/ { t = 0 }
+    {
+      s = $0
+      while (match(s, /prepare_branch(<[0-9]+>\(|\([0-9]+,)/)) {
+        p = substr(s, RSTART, RLENGTH)
+        gsub(/[^0-9]/, "", p)
+        if (p in prepared)
+          print "position " p " prepared more than once"
+        prepared[p + 0] = 1
+        s = substr(s, RSTART + RLENGTH)
+      }
+    }
+    /^[ \t]*_discograd\.inc_branch_visits?\([0-9]+(, *[0-9]+)?\);$/ {
+      args = $0
+      sub(/^[^(]*\(/, "", args)
+      sub(/\);$/, "", args)
+      k = split(args, r, /, */)
+      if (r[1] + 0 > r[k] + 0)
+        print "empty range in " $0
+      for (p = r[1] + 0; p <= r[k] + 0; p++)
+        visited[p] = 1
+    }
+    END {
+      for (p in prepared)
+        if (p + 0 > max_pos + 0)
+          print "position " p " prepared beyond _discograd_max_branch_pos = " max_pos
+      n = 0
+      for (p in prepared)
+        n++
+      if (n > 0 && n != max_pos + 1)
+        print n " positions prepared, expected " max_pos + 1
+      for (p in visited)
+        if (!(p in prepared))
+          print "position " p " counted as visited but not prepared"
+      if (num_capacities > 0 && num_capacities != max_pos + 1)
+        print num_capacities " branch capacities, expected " max_pos + 1
+    }' $1
+}
+
+status=0
+trap 'rm -f $files ${prefix}.log' EXIT
+for src in "${srcs[@]}"; do
+  echo "== $src"
+  prefix=${src%.*}_check
+  # the intermediate files are placed next to the source so that relative includes resolve
+  normalized=${prefix}_normalized.cpp smoothed=${prefix}_smoothed.cpp
+  passes=${prefix}_passes.cpp transformed=${prefix}_dgo.cpp unanalyzed=${prefix}_unanalyzed.cpp
+  files="$normalized $smoothed $passes $transformed $unanalyzed"
+
+  t0=$(now)
+  if ! { $base_dir/normalize $smooth_flags $src | clang-format > $normalized &&
+         $base_dir/smooth_dgo $smooth_flags $normalized | clang-format > $smoothed &&
+         $base_dir/insert_func_incr $insert_func_incr_flags $smoothed | clang-format > $passes; } 2> ${prefix}.log; then
+    echo "baseline passes failed:"; tail -n 20 ${prefix}.log
+    status=1; rm -f $files ${prefix}.log; continue
+  fi
+  t1=$(now)
+  if ! { ./transformation/dgo_transform --no-activity-analysis $smooth_flags $src > $unanalyzed &&
+         t2=$(now) &&
+         ./transformation/dgo_transform $smooth_flags $src > $transformed; } 2> ${prefix}.log; then
+    echo "dgo_transform failed:"; tail -n 20 ${prefix}.log
+    status=1; rm -f $files ${prefix}.log; continue
+  fi
+
+  echo "transformation time: passes $(elapsed $t0 $t1)s, dgo_transform $(elapsed $t1 $t2)s"
+  echo "branch visit calls: passes $(visit_calls $passes), dgo_transform $(visit_calls $unanalyzed)"
+  echo "branch capacities (position:capacity, 0: DGO_PREALLOC_BRANCH_DATA):$(capacities $transformed)"
+
+  for f in $unanalyzed $transformed; do
+    problems=$(check_positions $f)
+    if [ -n "$problems" ]; then
+      [ $f == $unanalyzed ] && echo "inconsistent branch positions without activity analysis:" \
+                            || echo "inconsistent branch positions:"
+      echo "$problems"
+      status=1
+    fi
+  done
+
+  if diff -u <(canonicalize $passes) <(canonicalize $unanalyzed) > ${prefix}.log; then
+    echo "without activity analysis: same as the baseline passes"
+  else
+    echo "without activity analysis: differs from the baseline passes:"
+    cat ${prefix}.log
+    status=1
+  fi
+
+  # declarations retyped to double, and any other change, which should not involve branch positions
+  echo "changed by the activity analysis:"
+  changes=$(diff <(canonicalize $unanalyzed) <(canonicalize $transformed) | grep '^[<>]')
+  echo "${changes:-(none)}"
+
+  if clang++ -fsyntax-only $cpp_flags -I. -DDGO -DFW_AD -Wno-unused-command-line-argument $transformed 2> ${prefix}.log; then
+    echo "compiles as DGO version"
+  else
+    echo "does not compile as DGO version:"; head -n 20 ${prefix}.log
+    status=1
+  fi
+
+  if [ -n "$CHECK_OUTPUT_DIR" ]; then
+    name=$(echo ${src%.*} | tr / _)
+    mkdir -p $CHECK_OUTPUT_DIR
+    cp $passes $CHECK_OUTPUT_DIR/${name}_passes.cpp
+    cp $transformed $CHECK_OUTPUT_DIR/${name}_dgo.cpp
+    diff -u $CHECK_OUTPUT_DIR/${name}_passes.cpp $CHECK_OUTPUT_DIR/${name}_dgo.cpp > $CHECK_OUTPUT_DIR/${name}.diff
+  fi
+
+  rm -f $files ${prefix}.log
+done
+
+exit $status
@@ -3,7 +3,7 @@
 compile() {
     clang++ -g -w -c -I/usr/lib/llvm-13/include -D_GNU_SOURCE -D__STDC_CONSTANT_MACROS -D__STDC_FORMAT_MACROS -D__STDC_LIMIT_MACROS  -Wall -Wextra -I/usr/lib/llvm-13/include -std=c++20   -fno-exceptions -D_GNU_SOURCE -D__STDC_CONSTANT_MACROS -D__STDC_FORMAT_MACROS -D__STDC_LIMIT_MACROS -fno-rtti $basename.cpp &&\
 
-    clang++ -g -w -o $basename -Wall -Wextra -I/usr/lib/llvm-13/include -std=c++20   -fno-exceptions -D_GNU_SOURCE -D__STDC_CONSTANT_MACROS -D__STDC_FORMAT_MACROS -D__STDC_LIMIT_MACROS -fno-rtti -L/usr/lib/llvm-13/lib $basename.o -Wl,--start-group -lclang -lclangFrontend -lclangDriver -lclangSerialization -lclangParse -lclangSema -lclangAnalysis -lclangEdit -lclangAST -lclangLex -lclangBasic -lclangTooling -lclangRewrite -lclangRewriteFrontend -Wl,--end-group -lLLVM-13
+    clang++ -g -w -o $basename -Wall -Wextra -I/usr/lib/llvm-13/include -std=c++20   -fno-exceptions -D_GNU_SOURCE -D__STDC_CONSTANT_MACROS -D__STDC_FORMAT_MACROS -D__STDC_LIMIT_MACROS -fno-rtti -L/usr/lib/llvm-13/lib $basename.o -Wl,--start-group -lclang -lclangFrontend -lclangDriver -lclangSerialization -lclangParse -lclangSema -lclangAnalysis -lclangEdit -lclangAST -lclangLex -lclangBasic -lclangTooling -lclangToolingCore -lclangToolingInclusions -lclangFormat -lclangRewrite -lclangRewriteFrontend -Wl,--end-group -lLLVM-13
 }
 
 fc37_compile() {
@@ -25,7 +25,7 @@ arch_compile() {
 }
 
 
-for basename in normalize smooth_dgo; do
+for basename in normalize smooth_dgo insert_func_incr dgo_transform; do
 # if the kernel is fedora or arch linux, use different linking args
 kernel_name="$(uname -r)"
   if [[ $kernel_name == *"fc37"* ]]; then  
@@ -0,0 +1,104 @@
+/** Runs all transformations for the DGO backend in a single process. The
+ *  program is parsed twice: once for normalization and once, from memory, for
+ *  smoothing. The visit counts for called functions only depend on the smoothed
+ *  branch positions, so they are inserted on the same AST as the smoothing.
+ *  The output is formatted in-process as clang-format would.
+ *
+ *  Copyright 2023, 2024 Philipp Andelfinger, Justin Kreikemeyer
+ *  
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ *  and associated documentation files (the “Software”), to deal in the Software without
+ *  restriction, including without limitation the rights to use, copy, modify, merge, publish,
+ *  distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *   
+ *    The above copyright notice and this permission notice shall be included in all copies or
+ *    substantial portions of the Software.
+ *    
+ *    THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ *    INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ *    PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ *    ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ *    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *    SOFTWARE.
+ */
+
+#include "clang/Format/Format.h"
+#include "clang/Tooling/Core/Replacement.h"
+#include "normalize.hpp"
+#include "smooth_dgo.hpp"
+#include "insert_func_incr.hpp"
+
+class DgoConsumer : public clang::ASTConsumer {
+public:
+  explicit DgoConsumer(ASTContext *Context) : Smooth(Context), FuncIncr(Context) {}
+
+  virtual void HandleTranslationUnit(clang::ASTContext &Context) {
+    Smooth.HandleTranslationUnit(Context);
+    collectTransitiveSmoothBranches();
+    FuncIncr.HandleTranslationUnit(Context);
+  }
+
+private:
+  SmoothConsumer Smooth;
+  FuncIncrConsumer FuncIncr;
+
+};
+
+class DgoAction : public clang::ASTFrontendAction {
+public:
+  virtual unique_ptr<clang::ASTConsumer>
+  CreateASTConsumer(clang::CompilerInstance &Compiler, StringRef InFile) {
+    return make_unique<DgoConsumer>(&Compiler.getASTContext());
+  }
+};
+
+/** Sort the includes and reformat the code using the style clang-format would
+ *  pick for a file at fname. Returns the code unchanged on errors. */
+string formatSource(const string &code, const string &fname) {
+  Expected<clang::format::FormatStyle> style = clang::format::getStyle("file", fname, "LLVM");
+  if (!style) {
+    logAllUnhandledErrors(style.takeError(), errs(), "Error ");
+    return code;
+  }
+
+  vector<tooling::Range> ranges = { tooling::Range(0, code.size()) };
+  Expected<string> sorted = tooling::applyAllReplacements(code, clang::format::sortIncludes(*style, code, ranges, fname));
+  if (!sorted) {
+    logAllUnhandledErrors(sorted.takeError(), errs(), "Error ");
+    return code;
+  }
+
+  ranges = { tooling::Range(0, sorted->size()) };
+  Expected<string> formatted = tooling::applyAllReplacements(*sorted, clang::format::reformat(*style, *sorted, ranges, fname));
+  if (!formatted) {
+    logAllUnhandledErrors(formatted.takeError(), errs(), "Error ");
+    return *sorted;
+  }
+  return *formatted;
+}
+
+int main(int argc, const char **argv) {
+  Expected<CommonOptionsParser> op =
+      CommonOptionsParser::create(argc, argv, ToolCategory);
+  if (auto err = op.takeError()) {
+    logAllUnhandledErrors(std::move(err), errs(), "Error ");
+    return -1;
+  }
+  string inFname = op->getSourcePathList()[0];
+
+  ClangTool NormalizeTool(op->getCompilations(), op->getSourcePathList());
+  int r = NormalizeTool.run(newFrontendActionFactory<NormalizeAction>().get());
+
+  string normalized = formatSource(getRewrittenMainFile(), inFname);
+
+  // a fresh tool, so that no file contents are cached from the first parse
+  rewriter = Rewriter();
+  ClangTool SmoothTool(op->getCompilations(), op->getSourcePathList());
+  SmoothTool.mapVirtualFile(getAbsolutePath(inFname), normalized);
+  r |= SmoothTool.run(newFrontendActionFactory<DgoAction>().get());
+
+  cout << formatSource(getSmoothedSource(), inFname);
+
+  return r;
+}
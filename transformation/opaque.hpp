@@ -0,0 +1,35 @@
+/** Identifies calls that the transformations treat as opaque
+ *
+ *  Copyright 2023, 2024 Philipp Andelfinger, Justin Kreikemeyer
+ *  
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ *  and associated documentation files (the “Software”), to deal in the Software without
+ *  restriction, including without limitation the rights to use, copy, modify, merge, publish,
+ *  distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *   
+ *    The above copyright notice and this permission notice shall be included in all copies or
+ *    substantial portions of the Software.
+ *    
+ *    THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ *    INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ *    PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ *    ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ *    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *    SOFTWARE.
+ */
+
+#pragma once
+
+#include "clang/AST/ExprCXX.h"
+
+/** Whether s is a call to _discograd.custom_op(), whose function and derivative
+ *  arguments are neither normalized nor smoothed nor searched for callees. */
+inline bool isOpaqueCall(const clang::Stmt *s) {
+  auto *e = clang::dyn_cast_or_null<clang::CXXMemberCallExpr>(s);
+  if (e == nullptr)
+    return false;
+
+  auto *m = e->getMethodDecl();
+  return m != nullptr && m->getNameAsString() == "custom_op";
+}
@@ -0,0 +1,116 @@
+/** State shared by the transformation passes.
+ *
+ *  Copyright 2023, 2024 Philipp Andelfinger, Justin Kreikemeyer
+ *  
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ *  and associated documentation files (the “Software”), to deal in the Software without
+ *  restriction, including without limitation the rights to use, copy, modify, merge, publish,
+ *  distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *   
+ *    The above copyright notice and this permission notice shall be included in all copies or
+ *    substantial portions of the Software.
+ *    
+ *    THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ *    INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ *    PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ *    ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ *    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *    SOFTWARE.
+ */
+
+#pragma once
+
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/Lex/Lexer.h"
+#include "clang/Rewrite/Core/Rewriter.h"
+#include "llvm/Support/CommandLine.h"
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+const bool print_debug = false;
+
+static llvm::cl::OptionCategory ToolCategory("DiscoGrad transformation");
+
+/** Collects the edits of the current pass. dgo_transform runs several passes
+ *  in one process and resets it in between. */
+inline clang::Rewriter rewriter;
+
+/** Smoothed branch positions per function, including those of its callees. */
+inline std::unordered_map<std::string, std::vector<int>> funcTransitiveSmoothBranches;
+
+#define GET_LOC_BEFORE_END(S)                                                  \
+  Lexer::getLocForEndOfToken(S->getEndLoc(), 0, srcMgr, langOpts)
+#define GET_LOC_END(S) GET_LOC_BEFORE_END(S).getLocWithOffset(1)
+
+/** The main file of the last pass with all edits applied. */
+inline std::string getRewrittenMainFile() {
+  const clang::RewriteBuffer &RewriteBuf =
+      rewriter.getEditBuffer(rewriter.getSourceMgr().getMainFileID());
+  return std::string(RewriteBuf.begin(), RewriteBuf.end());
+}
+
+/** Calls to the DGO backend that count a visit to each branch position per
+ *  occurrence in positions. Consecutive positions are counted by one call. */
+inline std::string branchVisitCalls(const std::vector<int> &positions) {
+  std::map<int, uint64_t> remaining;
+  for (int pos : positions)
+    remaining[pos]++;
+
+  std::string calls;
+  while (!remaining.empty()) {
+    auto it = remaining.begin();
+    while (it != remaining.end()) {
+      int first = it->first, last = first;
+      auto next = std::next(it);
+      while (next != remaining.end() && next->first == last + 1)
+        last = (next++)->first;
+
+      calls += "\n_discograd.inc_branch_visits(" + std::to_string(first) + ", " + std::to_string(last) + ");\n";
+
+      while (it != next)
+        it = --it->second == 0 ? remaining.erase(it) : std::next(it);
+    }
+  }
+  return calls;
+}
+
+/** Whether f is to be smoothed. */
+inline bool isSmoothFunction(const clang::FunctionDecl *f) {
+  return f->getNameInfo().getName().getAsString().find("_DiscoGrad_") != std::string::npos;
+}
+
+/** Base of the transformation passes that only traverses the functions to be
+ *  smoothed in the main file, including everything declared inside them.
+ *  Declarations from headers, e.g., of the STL or libtorch, are skipped.
+ */
+template <typename Derived>
+class SmoothFunctionVisitor : public clang::RecursiveASTVisitor<Derived> {
+public:
+  explicit SmoothFunctionVisitor(clang::SourceManager &srcMgr) : mainFileSrcMgr(srcMgr) {}
+
+  bool TraverseDecl(clang::Decl *D) {
+    if (D == nullptr || clang::isa<clang::TranslationUnitDecl>(D) || smoothFunctionDepth > 0)
+      return clang::RecursiveASTVisitor<Derived>::TraverseDecl(D);
+
+    if (!mainFileSrcMgr.isInMainFile(mainFileSrcMgr.getExpansionLoc(D->getLocation())))
+      return true;
+
+    auto *f = clang::dyn_cast<clang::FunctionDecl>(D);
+    if (f == nullptr)
+      return clang::RecursiveASTVisitor<Derived>::TraverseDecl(D);
+    if (!isSmoothFunction(f))
+      return true;
+
+    smoothFunctionDepth++;
+    bool r = clang::RecursiveASTVisitor<Derived>::TraverseDecl(D);
+    smoothFunctionDepth--;
+    return r;
+  }
+
+private:
+  clang::SourceManager &mainFileSrcMgr;
+  int smoothFunctionDepth = 0;
+};
@@ -0,0 +1,728 @@
+/** Contains an ASTVisitor that inserts the backend calls required
+ *  for smoothing.
+ *
+ *  Copyright 2023, 2024 Philipp Andelfinger, Justin Kreikemeyer
+ *  
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ *  and associated documentation files (the “Software”), to deal in the Software without
+ *  restriction, including without limitation the rights to use, copy, modify, merge, publish,
+ *  distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *   
+ *    The above copyright notice and this permission notice shall be included in all copies or
+ *    substantial portions of the Software.
+ *    
+ *    THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ *    INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ *    PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ *    ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ *    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *    SOFTWARE.
+ */
+
+#pragma once
+
+#include "clang/AST/ASTConsumer.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/ParentMapContext.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/FrontendAction.h"
+#include "clang/Rewrite/Core/Rewriter.h"
+#include "clang/Rewrite/Frontend/Rewriters.h"
+#include "clang/Tooling/CommonOptionsParser.h"
+#include "clang/Tooling/Tooling.h"
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include "opaque.hpp"
+#include "activity.hpp"
+#include "rewriting.hpp"
+
+using namespace clang;
+using namespace clang::tooling;
+using namespace llvm;
+using namespace std;
+
+inline unordered_map<string, vector<string>> directCallees;
+
+inline unordered_map<string, vector<int>> funcDirectSmoothBranches;
+
+inline uint64_t max_branch_pos = 0;
+
+/** Function and statically known executions per call of that function of each
+ *  smoothed branch position, 0 if unknown. */
+inline map<uint64_t, pair<string, uint64_t>> branchPosExecutions;
+
+/** Calls between smoothed functions as (caller, callee, executions per call of the caller). */
+inline vector<tuple<string, string, uint64_t>> smoothCalls;
+
+/** Largest number of visits per sample a position's storage is preallocated for. */
+const uint64_t max_static_branch_capacity = 10000000;
+
+static cl::opt<bool> NoActivityAnalysis("no-activity-analysis",
+                                        cl::desc("Smooth all branches on adoubles, even if they cannot depend on the inputs"),
+                                        cl::cat(ToolCategory));
+
+static cl::opt<string> BranchProfile("branch-profile",
+                                     cl::desc("Visits per branch position written by a DGO program run with --profile-branches, "
+                                              "used for the positions whose visits are not known statically"),
+                                     cl::value_desc("filename"), cl::cat(ToolCategory));
+
+/** Transforms the AST nodes of C++ functions to be smoothed 
+ *  by inserting calls to the DGO backend 
+ */
+class SmoothVisitor : public SmoothFunctionVisitor<SmoothVisitor> {
+private:
+  set<const Stmt *> LoopBodies;
+  set<const Stmt *> SmoothIfElseBodies;
+  set<const Stmt *> SmoothLoopBodies;
+  set<const Stmt *> SmoothFuncBodies;
+
+  string currFuncName;
+  SourceLocation currSmoothFunctionEndLoc;
+  bool currSmoothFunctionIsVoid = false;
+
+  SourceManager &srcMgr;
+  const LangOptions &langOpts;
+
+  uint64_t nextBranchPos = 0;
+
+  ActivityAnalysis *Activity;
+
+public:
+  explicit SmoothVisitor(ASTContext *Context, ActivityAnalysis *Activity) : SmoothFunctionVisitor(Context->getSourceManager()), Context(Context), srcMgr(Context->getSourceManager()), langOpts(Context->getLangOpts()), Activity(Activity) {
+    rewriter.setSourceMgr(srcMgr, langOpts);
+  }
+
+  void collectCalledFuncs(Stmt *stmt, vector<string>& funcNames) {
+    if (stmt == nullptr || isOpaqueCall(stmt))
+      return;
+    if (isa<CXXMemberCallExpr>(stmt)) {
+      CXXMemberCallExpr *e = cast<CXXMemberCallExpr>(stmt);
+      if (isa<CXXMethodDecl>(e->getCalleeDecl())) {
+        CXXMethodDecl *callee = cast<CXXMethodDecl>(e->getCalleeDecl());
+        string funcName = callee->getNameInfo().getAsString();
+        funcNames.push_back(funcName);
+      }
+    }
+    for (auto it = stmt->children().begin(); it != stmt->children().end(); it++)
+      collectCalledFuncs(*it, funcNames);
+  }
+
+  bool needsSmoothing(Stmt *stmt) {
+    if (isa<Expr>(stmt)) {
+      Expr *e = cast<Expr>(stmt);
+      string typeStr = e->getType().getAsString();
+      if (typeStr.find("adouble") != string::npos) {
+        return true;
+      }
+    }
+    for (auto it = stmt->children().begin(); it != stmt->children().end(); it++) {
+      if (needsSmoothing(*it))
+        return true;
+    }
+    return false;
+  }
+
+  /** Branches on adoubles that cannot depend on the inputs are left as they are. */
+  bool needsSmoothingBranch(Expr *Cond) {
+    return needsSmoothing(Cond) && Activity->isActive(Cond);
+  }
+
+  /** Declare the adoubles the activity analysis found to be passive as doubles. */
+  void retypePassiveVars() {
+    for (const VarDecl *V : Activity->getPassiveVars()) {
+      SourceRange TypeRange = V->getTypeSourceInfo()->getTypeLoc().getSourceRange();
+      if (rewriter.getRewrittenText(TypeRange) != "adouble")
+        continue;
+      if (print_debug)
+        cerr << "retyping passive variable " << V->getNameAsString() << endl;
+      rewriter.ReplaceText(TypeRange, "double");
+    }
+  }
+
+  uint64_t countNestedIfs(Stmt *stmt) {
+    if (stmt == nullptr || isOpaqueCall(stmt)) {
+      return 0;
+    }
+
+    uint64_t count = 0;
+    if (isa<IfStmt>(stmt)) {
+      IfStmt *If = cast<IfStmt>(stmt);
+      Expr *Cond = If->getCond();
+      auto CondText = rewriter.getRewrittenText(Cond->getSourceRange());
+
+      string unhandledOps[] = { "||", "&&", "==", "!=" };
+
+      bool skip = false;
+      for (auto &op : unhandledOps) {
+        if (CondText.find(op) != string::npos) {
+          skip = true;
+          break;
+        }
+      }
+      
+      if (!skip && needsSmoothingBranch(Cond))
+        count++;
+    }
+    for (auto it = stmt->children().begin(); it != stmt->children().end(); it++) {
+      count += countNestedIfs(*it);
+    }
+    return count;
+  }
+
+  /** Constant value of an integer expression. */
+  bool evaluateInt(const Expr *e, int64_t &value) {
+    Expr::EvalResult Result;
+    if (e == nullptr || e->isValueDependent() || !e->EvaluateAsInt(Result, *Context))
+      return false;
+    value = Result.Val.getInt().getExtValue();
+    return true;
+  }
+
+  /** Whether V is only read in stmt. */
+  bool isReadOnlyIn(const VarDecl *V, const Stmt *stmt) {
+    if (stmt == nullptr)
+      return true;
+    for (const Stmt *child : stmt->children()) {
+      if (child == nullptr)
+        continue;
+      auto *Ref = dyn_cast<DeclRefExpr>(child);
+      auto *Cast = dyn_cast<ImplicitCastExpr>(stmt);
+      if (Ref != nullptr && Ref->getDecl() == V && (Cast == nullptr || Cast->getCastKind() != CK_LValueToRValue))
+        return false;
+      if (!isReadOnlyIn(V, child))
+        return false;
+    }
+    return true;
+  }
+
+  /** Number of iterations of a loop for (i = a; i < b; i += c) with constant a, b, and c
+   *  and i only read in the body, or any other comparison matching the sign of c.
+   *  0 if unknown. */
+  uint64_t tripCount(const ForStmt *For) {
+    const VarDecl *V = nullptr;
+    int64_t first, bound, step;
+    if (auto *Init = dyn_cast_or_null<DeclStmt>(For->getInit())) {
+      if (Init->isSingleDecl())
+        V = dyn_cast<VarDecl>(Init->getSingleDecl());
+      if (V == nullptr || !evaluateInt(V->getInit(), first))
+        return 0;
+    } else if (auto *Init = dyn_cast_or_null<BinaryOperator>(For->getInit())) {
+      auto *Ref = dyn_cast<DeclRefExpr>(Init->getLHS()->IgnoreParenImpCasts());
+      if (Init->getOpcode() != BO_Assign || Ref == nullptr || !evaluateInt(Init->getRHS(), first))
+        return 0;
+      V = dyn_cast<VarDecl>(Ref->getDecl());
+    }
+    if (V == nullptr || !V->getType()->isIntegerType())
+      return 0;
+
+    auto refersToV = [V](const Expr *e) {
+      auto *Ref = dyn_cast<DeclRefExpr>(e->IgnoreParenImpCasts());
+      return Ref != nullptr && Ref->getDecl() == V;
+    };
+
+    auto *Cond = dyn_cast_or_null<BinaryOperator>(For->getCond() ? For->getCond()->IgnoreParenImpCasts() : nullptr);
+    if (Cond == nullptr || !refersToV(Cond->getLHS()) || !evaluateInt(Cond->getRHS(), bound))
+      return 0;
+
+    if (auto *Inc = dyn_cast_or_null<UnaryOperator>(For->getInc())) {
+      if (!refersToV(Inc->getSubExpr()) || !Inc->isIncrementDecrementOp())
+        return 0;
+      step = Inc->isIncrementOp() ? 1 : -1;
+    } else if (auto *Inc = dyn_cast_or_null<CompoundAssignOperator>(For->getInc())) {
+      if (!refersToV(Inc->getLHS()) || !evaluateInt(Inc->getRHS(), step) || step == 0)
+        return 0;
+      if (Inc->getOpcode() == BO_SubAssign)
+        step = -step;
+      else if (Inc->getOpcode() != BO_AddAssign)
+        return 0;
+    } else {
+      return 0;
+    }
+
+    if (!isReadOnlyIn(V, For->getBody()))
+      return 0;
+
+    __int128 dist = step > 0 ? (__int128)bound - first : (__int128)first - bound;
+    __int128 absStep = step > 0 ? step : -(__int128)step;
+    __int128 n;
+    switch (Cond->getOpcode()) {
+    case BO_LT:
+    case BO_GT:
+      if ((Cond->getOpcode() == BO_LT) != (step > 0))
+        return 0;
+      n = dist > 0 ? (dist + absStep - 1) / absStep : 0;
+      break;
+    case BO_LE:
+    case BO_GE:
+      if ((Cond->getOpcode() == BO_LE) != (step > 0))
+        return 0;
+      n = dist >= 0 ? dist / absStep + 1 : 0;
+      break;
+    case BO_NE:
+      if (dist < 0 || dist % absStep != 0)
+        return 0;
+      n = dist / absStep;
+      break;
+    default:
+      return 0;
+    }
+    return n > max_static_branch_capacity ? 0 : (uint64_t)max<__int128>(n, 1);
+  }
+
+  /** Upper bound on the executions of stmt per call of the current function, from the
+   *  trip counts of the surrounding loops. 0 if unknown. */
+  uint64_t executionsPerCall(const Stmt *stmt) {
+    uint64_t r = 1;
+    DynTypedNode child = DynTypedNode::create(*stmt);
+    DynTypedNodeList parents = Context->getParents(*stmt);
+    while (!parents.empty()) {
+      if (auto *f = parents[0].get<FunctionDecl>())
+        return f->getNameInfo().getName().getAsString() == currFuncName ? r : 0;
+
+      uint64_t n = 1;
+      if (auto *For = parents[0].get<ForStmt>()) {
+        // the init statement runs once
+        if (child.get<Stmt>() != For->getInit()) {
+          n = tripCount(For);
+          if (n > 0 && child.get<Stmt>() != For->getBody())
+            n++; // condition and increment
+        }
+      } else if (auto *Range = parents[0].get<CXXForRangeStmt>()) {
+        if (child.get<Stmt>() == Range->getBody()) {
+          auto *Array = Context->getAsConstantArrayType(Range->getRangeInit()->getType());
+          n = Array ? max<uint64_t>(Array->getSize().getZExtValue(), 1) : 0;
+        }
+      } else if (parents[0].get<WhileStmt>() || parents[0].get<DoStmt>() || parents[0].get<LambdaExpr>()) {
+        n = 0;
+      }
+      if (n == 0 || n > max_static_branch_capacity / r)
+        return 0;
+      r *= n;
+
+      child = parents[0];
+      parents = Context->getParents(parents[0]);
+    }
+    return 0;
+  }
+
+  bool crispUpToOutermostLoop(Stmt *stmt) {
+    DynTypedNodeList parents = Context->getParents(*stmt);
+    while (!parents.empty()) {
+      const Stmt *p = parents[0].get<Stmt>();
+      if (!p)
+        break;
+      if (SmoothIfElseBodies.contains(p))
+        return false;
+      if (LoopBodies.contains(p))
+        return !SmoothLoopBodies.contains(p);
+
+      parents = Context->getParents(*p);
+    }
+    assert(false);
+  }
+
+  std::string removeParen(const std::string in) {
+    if (in[0] != '(' || in[in.size() - 1] != ')')
+      return in;
+
+    for (int num_open = 1, i = 1; i < in.size(); i++) {
+      if (in[i] == '(')
+        num_open++;
+      if (in[i] == ')')
+        num_open--;
+
+      if (num_open == 0 && i < in.size() - 1)
+        return in;
+    }
+
+    return in.substr(1, in.size() - 2);
+  }
+
+  /** Skip the arguments of calls to _discograd.custom_op(). */
+  bool TraverseCXXMemberCallExpr(CXXMemberCallExpr *e) {
+    if (isOpaqueCall(e))
+      return true;
+    return RecursiveASTVisitor<SmoothVisitor>::TraverseCXXMemberCallExpr(e);
+  }
+
+  bool VisitStmt(Stmt *s) {
+
+    if (print_debug) {
+      string out_str;
+      raw_string_ostream outstream(out_str);
+      s->printPretty(outstream, NULL, PrintingPolicy(langOpts));
+      cerr << "current statement: " << out_str << endl;
+    }
+
+    if (s->getBeginLoc() >= currSmoothFunctionEndLoc) {
+      return true;
+    }
+
+    if (isa<IfStmt>(s)) {
+      IfStmt *If = cast<IfStmt>(s);
+      Stmt *Else = If->getElse();
+      Expr *Cond = If->getCond();
+
+      bool smoothedBranch = false;
+      if (needsSmoothingBranch(Cond)) {
+
+        auto CondText = rewriter.getRewrittenText(Cond->getSourceRange());
+
+        string unhandledOps[] = { "||", "&&", "==", "!=" };
+
+        bool skip = false;
+        for (auto &op : unhandledOps)
+          if (CondText.find(op) != string::npos)
+            skip = true;
+
+        if (CondText.starts_with("_abl_dist <= ") && CondText.ends_with(" + radiusTol"))
+          skip = true;
+        if (CondText.starts_with("crisp_") && CondText.ends_with(" + radiusTol"))
+          skip = true;
+
+        if (!skip) {
+          string leCmps[] = { "<=", "<" };
+          for (const string& cmpOp : leCmps) {
+            auto cmpPos = CondText.find(cmpOp);
+            if (cmpPos != string::npos) {
+              CondText.replace(cmpPos, cmpOp.length(), "-(");
+              CondText += ")";
+              smoothedBranch = true;
+            }
+          }
+
+          auto InnerCondText = CondText;
+          std::string OuterCondText;
+          do {
+            OuterCondText = InnerCondText;
+            InnerCondText = removeParen(OuterCondText);
+            //std::cerr << "outer cond text: " << OuterCondText << std::endl;
+            //std::cerr << "inner cond text: " << InnerCondText << std::endl;
+          } while (InnerCondText != OuterCondText);
+          CondText = InnerCondText;
+
+          auto geCmps = { ">=", ">" };
+          for (const string& cmpOp : geCmps) {
+            auto cmpPos = CondText.find(cmpOp);
+            // handle the dereferencing member access operator ->
+            // (skip every > that is preceeded by a -; note that this prohibits the use of a-->b for now)
+            while (cmpPos != string::npos && cmpOp == ">" && CondText[cmpPos - 1] == '-') {
+              auto newPos = CondText.substr(cmpPos + cmpOp.length()).find(cmpOp);
+              if (newPos != string::npos) {
+                cmpPos += newPos + 1;
+              } else {
+                cmpPos = string::npos;
+                break;
+              }
+            }
+            if (cmpPos != string::npos) {
+              CondText = CondText.substr(cmpPos + cmpOp.length()) + "- (" + CondText.substr(0, cmpPos) + ")";
+              smoothedBranch = true;
+            }
+          }
+
+          if (smoothedBranch) {
+            auto condVarName = "_discograd_cond_" + to_string(nextBranchPos);
+            rewriter.InsertText(If->getBeginLoc(), "\nadouble " + condVarName + " = " + CondText + ";\n"); 
+            auto endBlockLoc = GET_LOC_BEFORE_END(Else);
+            rewriter.InsertText(If->getBeginLoc(), "\n_discograd.template prepare_branch<" + to_string(nextBranchPos) + ">(" + condVarName + ");\n"); 
+            rewriter.InsertText(Cond->getBeginLoc(), condVarName + " < 0.0 /*"); 
+            rewriter.InsertText(GET_LOC_BEFORE_END(Cond), " */"); 
+
+            rewriter.InsertText(endBlockLoc, "\n_discograd.end_block();\n");
+
+            funcDirectSmoothBranches[currFuncName].push_back(nextBranchPos);
+            branchPosExecutions[nextBranchPos] = { currFuncName, executionsPerCall(If) };
+
+            max_branch_pos = std::max(max_branch_pos, nextBranchPos);
+          }
+        }
+      }
+
+      Stmt *Then = If->getThen();
+      vector<uint64_t> thenBranchPositions;
+      vector<uint64_t> elseBranchPositions;
+      uint64_t thenIfs = countNestedIfs(Then);
+      uint64_t elseIfs = countNestedIfs(Else);
+
+      uint64_t bpos = nextBranchPos + smoothedBranch;
+      vector<int> thenPositions, elsePositions;
+      for (int i = 0; i < thenIfs; i++)
+        thenPositions.push_back(bpos++);
+      for (int i = 0; i < elseIfs; i++)
+        elsePositions.push_back(bpos++);
+      rewriter.InsertText(Else->getBeginLoc().getLocWithOffset(1), branchVisitCalls(thenPositions));
+      rewriter.InsertText(Then->getBeginLoc().getLocWithOffset(1), branchVisitCalls(elsePositions));
+
+      vector<string> thenCalledFuncs, elseCalledFuncs;
+      collectCalledFuncs(Then, thenCalledFuncs);
+      collectCalledFuncs(Else, elseCalledFuncs);
+
+      auto endBlockLoc = GET_LOC_BEFORE_END(Else);
+
+      if (smoothedBranch) {
+        nextBranchPos++;
+      }
+      
+    }
+    
+
+    return true;
+  }
+
+  bool VisitCallExpr(CallExpr *e) {
+    if (e->getBeginLoc() >= currSmoothFunctionEndLoc)
+      return true;
+
+    FunctionDecl *callee = e->getDirectCallee();
+    if (callee != nullptr && isSmoothFunction(callee))
+      smoothCalls.push_back({ currFuncName, callee->getNameInfo().getName().getAsString(), executionsPerCall(e) });
+
+    return true;
+  }
+
+  bool VisitFunctionDecl(FunctionDecl *f) {
+    if (f->hasBody()) {
+      SourceManager &srcMgr = rewriter.getSourceMgr();
+      const LangOptions &langOpts = rewriter.getLangOpts();
+
+      Stmt *FuncBody = f->getBody();
+
+      QualType QT = f->getReturnType();
+      string TypeStr = QT.getAsString();
+
+      DeclarationName DeclName = f->getNameInfo().getName();
+      string FuncName = DeclName.getAsString();
+
+      size_t found = FuncName.find("_DiscoGrad_");
+      if (found != string::npos) {
+        currSmoothFunctionIsVoid = !TypeStr.compare("void");
+
+        currSmoothFunctionEndLoc = GET_LOC_END(FuncBody);
+        
+        currFuncName = FuncName;
+        collectCalledFuncs(FuncBody, directCallees[FuncName]);
+
+        SmoothFuncBodies.insert(FuncBody);
+     }
+   }
+
+    return true;
+  }
+
+private:
+  ASTContext *Context;
+};
+
+class SmoothConsumer : public clang::ASTConsumer {
+public:
+  explicit SmoothConsumer(ASTContext *Context) : Activity(Context), Visitor(Context, &Activity) {}
+
+  virtual void HandleTranslationUnit(clang::ASTContext &Context) {
+    if (!NoActivityAnalysis)
+      Activity.run();
+    Visitor.TraverseDecl(Context.getTranslationUnitDecl());
+    Visitor.retypePassiveVars();
+  }
+
+private:
+  ActivityAnalysis Activity;
+  SmoothVisitor Visitor;
+
+};
+
+class SmoothAction : public clang::ASTFrontendAction {
+public:
+  virtual unique_ptr<clang::ASTConsumer>
+  CreateASTConsumer(clang::CompilerInstance &Compiler, StringRef InFile) {
+    return make_unique<SmoothConsumer>(&Compiler.getASTContext());
+  }
+};
+
+/** Collects the smoothed branch positions reachable from each function in
+ *  the call graph. A position occurs once per call path that reaches it. Tarjan's
+ *  algorithm completes the strongly connected components callees first, so
+ *  that the positions of each component are computed once from its members and
+ *  the components it calls. All functions of a recursive cycle share the
+ *  positions of the cycle, counting the cycle's own branches once.
+ */
+class SmoothBranchCollector {
+public:
+  void run() {
+    vector<string> funcs;
+    for (auto &item : directCallees)
+      funcs.push_back(item.first);
+    for (auto &func : funcs)
+      if (!index.contains(func))
+        visit(func);
+  }
+
+private:
+  unordered_map<string, int> index, lowlink, component;
+  vector<string> stack;
+  set<string> onStack;
+  vector<map<int, uint64_t>> componentBranches; /**< occurrences per position */
+  int nextIndex = 0;
+
+  const vector<string> &callees(const string &func) {
+    static const vector<string> none;
+    auto it = directCallees.find(func);
+    return it == directCallees.end() ? none : it->second;
+  }
+
+  void visit(const string &func) {
+    index[func] = lowlink[func] = nextIndex++;
+    stack.push_back(func);
+    onStack.insert(func);
+
+    for (auto &c : callees(func)) {
+      if (!index.contains(c)) {
+        visit(c);
+        lowlink[func] = min(lowlink[func], lowlink[c]);
+      } else if (onStack.contains(c)) {
+        lowlink[func] = min(lowlink[func], index[c]);
+      }
+    }
+
+    if (lowlink[func] != index[func])
+      return;
+
+    int comp = componentBranches.size();
+    vector<string> members;
+    do {
+      members.push_back(stack.back());
+      onStack.erase(stack.back());
+      component[stack.back()] = comp;
+      stack.pop_back();
+    } while (members.back() != func);
+
+    map<int, uint64_t> branches;
+    for (auto &m : members) {
+      auto direct = funcDirectSmoothBranches.find(m);
+      if (direct != funcDirectSmoothBranches.end())
+        for (int pos : direct->second)
+          branches[pos] = 1;
+      for (auto &c : callees(m))
+        if (component[c] != comp)
+          for (auto &[pos, num] : componentBranches[component[c]])
+            branches[pos] += num;
+    }
+
+    vector<int> positions;
+    for (auto &[pos, num] : branches)
+      positions.insert(positions.end(), num, pos);
+    for (auto &m : members)
+      if (directCallees.contains(m))
+        funcTransitiveSmoothBranches[m] = positions;
+    componentBranches.push_back(std::move(branches));
+  }
+};
+
+/** Sets funcTransitiveSmoothBranches to the smoothed branch positions of each
+ *  function and its transitive callees. */
+inline void collectTransitiveSmoothBranches() {
+  SmoothBranchCollector().run();
+}
+
+/** Upper bounds on the calls per sample of each smoothed function, 0 if unknown.
+ *  Functions not called by other smoothed functions are assumed to be called once,
+ *  recursive functions and their callees are unknown. */
+class SmoothCallCounter {
+public:
+  SmoothCallCounter() {
+    for (auto &[caller, callee, executions] : smoothCalls)
+      callers[callee].push_back({ caller, executions });
+  }
+
+  uint64_t calls(const string &func) {
+    if (auto it = numCalls.find(func); it != numCalls.end())
+      return it->second;
+    if (!onPath.insert(func).second)
+      return 0;
+
+    uint64_t r = callers.contains(func) ? 0 : 1;
+    for (auto &[caller, executions] : callers[func]) {
+      uint64_t c = calls(caller);
+      if (c == 0 || executions == 0 || c * executions > max_static_branch_capacity - r) {
+        r = 0;
+        break;
+      }
+      r += c * executions;
+    }
+
+    onPath.erase(func);
+    // a result within a cycle depends on the members still on the path
+    if (onPath.empty() || r > 0)
+      numCalls[func] = r;
+    return r;
+  }
+
+private:
+  unordered_map<string, vector<pair<string, uint64_t>>> callers;
+  unordered_map<string, uint64_t> numCalls;
+  set<string> onPath;
+};
+
+/** Visits per sample from a DGO program run with --profile-branches, empty if not given or not matching. */
+inline vector<uint64_t> readBranchProfile() {
+  vector<uint64_t> visits;
+  if (BranchProfile.empty())
+    return visits;
+
+  ifstream f(BranchProfile);
+  if (!f) {
+    cerr << "cannot read branch profile " << BranchProfile << ", ignoring" << endl;
+    return visits;
+  }
+  uint64_t pos, num;
+  while (f >> pos >> num) {
+    if (pos != visits.size()) {
+      visits.clear();
+      break;
+    }
+    visits.push_back(num);
+  }
+  if (visits.size() != max_branch_pos + 1) {
+    cerr << "branch profile " << BranchProfile << " does not match the program, ignoring" << endl;
+    visits.clear();
+  }
+  return visits;
+}
+
+/** Number of visits per sample to preallocate for each branch position: the
+ *  statically known bound, otherwise the profiled maximum, or 0 to leave the
+ *  choice to the backend. */
+inline vector<uint64_t> getBranchCapacities() {
+  vector<uint64_t> capacities(max_branch_pos + 1, 0);
+  vector<uint64_t> profile = readBranchProfile();
+  SmoothCallCounter counter;
+  for (uint64_t pos = 0; pos <= max_branch_pos; pos++) {
+    auto it = branchPosExecutions.find(pos);
+    if (it != branchPosExecutions.end()) {
+      auto &[func, executions] = it->second;
+      uint64_t calls = counter.calls(func);
+      if (calls > 0 && executions > 0 && calls <= max_static_branch_capacity / executions)
+        capacities[pos] = calls * executions;
+    }
+    if (capacities[pos] == 0 && !profile.empty())
+      capacities[pos] = max<uint64_t>(profile[pos], 1);
+  }
+  return capacities;
+}
+
+/** The smoothed main file, preceded by the highest branch position used and
+ *  the capacities of the positions. */
+inline string getSmoothedSource() {
+  string capacities;
+  for (uint64_t c : getBranchCapacities())
+    capacities += (capacities.empty() ? "" : ", ") + to_string(c);
+
+  return "const int _discograd_max_branch_pos = " + to_string(max_branch_pos) + ";\n" +
+         "constexpr unsigned long _discograd_branch_capacity[] = {" + capacities + "};\n\n" + getRewrittenMainFile();
+}